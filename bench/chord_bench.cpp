@@ -0,0 +1,298 @@
+#include "store.hpp"
+#include "client.hpp"
+#include "server.hpp"
+#include "message.hpp"
+#include "hashtype.hpp"
+#include "fingertable.hpp"
+#include "connectionpool.hpp"
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+#include <icarus/buffer.hpp>
+#include <icarus/eventloop.hpp>
+#include <icarus/inetaddress.hpp>
+
+using namespace chord;
+
+/**
+ * chord_bench [filter]
+ *
+ * microbenchmarks of the routing and message hot paths,
+ *  one JSON object per line on stdout for each benchmark
+ *  whose name contains the filter:
+ *
+ *  {"name":"...","iterations":N,"ns_per_op":X,"ops_per_sec":Y}
+ *
+ * the logs of the library are silenced so that stdout stays parseable
+*/
+namespace
+{
+constexpr auto kMinTime = std::chrono::milliseconds(200);
+constexpr int kRepeats = 5;
+constexpr std::size_t kNodes = 256;
+constexpr std::size_t kInputs = 1 << 12;
+/**
+ * the node answering the round trips, on loopback
+*/
+constexpr std::uint16_t kPort = 47000;
+
+template <typename T>
+void keep(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+class Suite
+{
+  public:
+    Suite(std::ostream &out, std::string filter)
+      : out_(out)
+      , filter_(std::move(filter))
+    {
+        // ...
+    }
+
+    bool selected(const std::string &name) const
+    {
+        return name.find(filter_) != std::string::npos;
+    }
+
+    /**
+     * the batch is doubled until it takes kMinTime,
+     *  then the median of kRepeats batches of that size is reported
+    */
+    template <typename F>
+    void run(const std::string &name, F &&f)
+    {
+        if (!selected(name))
+        {
+            return;
+        }
+
+        std::uint64_t batch = 1;
+        while (time(f, batch) < kMinTime && batch < (1ull << 40))
+        {
+            batch *= 2;
+        }
+
+        std::vector<double> samples;
+        for (int i = 0; i < kRepeats; ++i)
+        {
+            std::chrono::duration<double, std::nano> elapsed = time(f, batch);
+            samples.push_back(elapsed.count() / batch);
+        }
+        std::sort(samples.begin(), samples.end());
+        auto ns = samples[samples.size() / 2];
+
+        out_ << "{\"name\":\"" << name << "\""
+            << ",\"iterations\":" << batch
+            << ",\"ns_per_op\":" << ns
+            << ",\"ops_per_sec\":" << static_cast<std::uint64_t>(1e9 / ns)
+            << "}" << std::endl;
+    }
+
+  private:
+    template <typename F>
+    static std::chrono::steady_clock::duration time(F &f, std::uint64_t batch)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (std::uint64_t i = 0; i < batch; ++i)
+        {
+            f(i);
+        }
+        return std::chrono::steady_clock::now() - start;
+    }
+
+  private:
+    std::ostream &out_;
+    std::string filter_;
+};
+
+std::vector<Node> make_peers()
+{
+    std::vector<Node> peers;
+    for (std::size_t i = 1; i <= kNodes; ++i)
+    {
+        peers.emplace_back(icarus::InetAddress("127.0.0.1", static_cast<std::uint16_t>(5000 + i)));
+    }
+    return peers;
+}
+
+std::vector<HashType> make_hashes()
+{
+    std::mt19937_64 gen(42);
+    std::vector<HashType> hashes;
+    for (std::size_t i = 0; i < kInputs; ++i)
+    {
+        hashes.emplace_back(gen());
+    }
+    return hashes;
+}
+
+void bench_hashtype(Suite &suite)
+{
+    auto hashes = make_hashes();
+    suite.run("hashtype/between", [&] (std::uint64_t i)
+    {
+        auto &hash = hashes[i % kInputs];
+        auto result = hash.between(hashes[(i + 1) % kInputs], hashes[(i + 2) % kInputs]);
+        keep(result);
+    });
+}
+
+void bench_fingertable(Suite &suite)
+{
+    icarus::InetAddress self_addr("127.0.0.1", 5000);
+    auto peers = make_peers();
+    auto hashes = make_hashes();
+
+    FingerTable table(self_addr);
+    for (auto &node : peers)
+    {
+        table.insert(node);
+    }
+
+    suite.run("fingertable/find_closest_pre", [&] (std::uint64_t i)
+    {
+        keep(table.find_closest_pre(hashes[i % kInputs]));
+    });
+    suite.run("fingertable/find_closest_suc", [&] (std::uint64_t i)
+    {
+        keep(table.find_closest_suc(hashes[i % kInputs]));
+    });
+
+    /**
+     * a fresh table every kNodes inserts,
+     *  so that it's measured while growing like in a joining node
+    */
+    FingerTable growing(self_addr);
+    suite.run("fingertable/insert", [&] (std::uint64_t i)
+    {
+        if (i % kNodes == 0)
+        {
+            growing = FingerTable(self_addr);
+        }
+        growing.insert(peers[i % kNodes]);
+    });
+}
+
+void bench_message(Suite &suite)
+{
+    auto hashes = make_hashes();
+    Message findsuc(Message::FindSuc, hashes[0]);
+    Message prenotify(Message::PreNotify, icarus::InetAddress("127.0.0.1", 5001));
+    for (std::uint16_t port = 5002; port < 5006; ++port)
+    {
+        prenotify.add_addr(icarus::InetAddress("127.0.0.1", port));
+    }
+
+    auto findsuc_line = findsuc.to_str();
+    auto prenotify_line = prenotify.to_str();
+    auto strip = [] (const std::string &line)
+    {
+        return line.substr(0, line.size() - 2);
+    };
+
+    suite.run("message/to_str/findsuc", [&] (std::uint64_t)
+    {
+        keep(findsuc.to_str());
+    });
+    suite.run("message/to_str/prenotify", [&] (std::uint64_t)
+    {
+        keep(prenotify.to_str());
+    });
+
+    auto findsuc_text = strip(findsuc_line);
+    auto prenotify_text = strip(prenotify_line);
+    suite.run("message/parse_string/findsuc", [&] (std::uint64_t)
+    {
+        keep(Message::parse(findsuc_text));
+    });
+    suite.run("message/parse_string/prenotify", [&] (std::uint64_t)
+    {
+        keep(Message::parse(prenotify_text));
+    });
+
+    /**
+     * includes appending the line to the buffer
+    */
+    icarus::Buffer buf;
+    suite.run("message/parse_buffer/findsuc", [&] (std::uint64_t)
+    {
+        buf.append(findsuc_line.data(), findsuc_line.size());
+        keep(Message::parse(&buf));
+    });
+    suite.run("message/parse_buffer/prenotify", [&] (std::uint64_t)
+    {
+        buf.append(prenotify_line.data(), prenotify_line.size());
+        keep(Message::parse(&buf));
+    });
+
+    auto frame = prenotify.to_frame();
+    suite.run("message/parse_frame/prenotify", [&] (std::uint64_t)
+    {
+        buf.append(frame.data(), frame.size());
+        bool malformed = false;
+        auto view = MessageView::parse(&buf, malformed);
+        buf.retrieve(view->frame_size());
+        keep(view);
+    });
+}
+
+/**
+ * a self-booted node on loopback answers ClosestPre,
+ *  which is the cheapest request that goes through the pool,
+ *  the server and back without touching the store
+*/
+void bench_round_trip(Suite &suite)
+{
+    if (!suite.selected("client/round_trip"))
+    {
+        return;
+    }
+
+    icarus::EventLoop loop;
+    icarus::InetAddress addr("127.0.0.1", kPort);
+    ConnectionPool pool(&loop);
+    Store store("/tmp/chord_bench-" + std::to_string(::getpid()));
+    Server server(&loop, addr, pool, store);
+    server.set_thread_num(1);
+    server.start();
+    server.self_boot();
+
+    std::thread bench_thread([&suite, &loop, &pool, addr]
+    {
+        Message msg(Message::ClosestPre, HashType(42));
+        suite.run("client/round_trip", [&] (std::uint64_t)
+        {
+            Client client(pool, addr, std::chrono::seconds(1));
+            keep(client.send_and_wait_response(msg));
+        });
+        loop.quit();
+    });
+
+    loop.loop();
+    bench_thread.join();
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    std::ostream out(std::cout.rdbuf());
+    std::cout.rdbuf(nullptr);
+
+    Suite suite(out, argc > 1 ? argv[1] : "");
+    bench_hashtype(suite);
+    bench_fingertable(suite);
+    bench_message(suite);
+    bench_round_trip(suite);
+
+    return 0;
+}
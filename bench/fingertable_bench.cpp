@@ -0,0 +1,150 @@
+#include "hashtype.hpp"
+#include "fingertable.hpp"
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+using namespace chord;
+
+namespace
+{
+constexpr std::size_t kNodes = 256;
+constexpr std::size_t kQueries = 1 << 20;
+constexpr int kRounds = 8;
+
+/**
+ * the linear scan over 64 Node objects used before,
+ *  kept here as the baseline to compare with
+*/
+const Node &linear_closest_pre(const std::vector<Node> &nodes, const Node &self, const HashType &hash)
+{
+    constexpr std::size_t max = -1;
+
+    std::size_t ind = 0;
+    std::size_t dis = max;
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto now = nodes[i].hash().value();
+        auto d = now <= hash.value() ? hash.value() - now : hash.value() + max - now;
+        if (d < dis)
+        {
+            dis = d;
+            ind = i;
+        }
+    }
+
+    if (dis == max)
+    {
+        return self;
+    }
+    return nodes[ind];
+}
+
+const Node &linear_closest_suc(const std::vector<Node> &nodes, const Node &self, const HashType &hash)
+{
+    constexpr std::size_t max = -1;
+
+    std::size_t ind = 0;
+    std::size_t dis = max;
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto now = nodes[i].hash().value();
+        if (now == hash.value())
+        {
+            continue;
+        }
+        auto d = hash.value() < now ? now - hash.value() : now + max - hash.value();
+        if (d < dis)
+        {
+            dis = d;
+            ind = i;
+        }
+    }
+
+    if (dis == max)
+    {
+        return self;
+    }
+    return nodes[ind];
+}
+
+template <typename F>
+void report(const char *name, F &&f, const std::vector<HashType> &queries)
+{
+    std::size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round)
+    {
+        for (auto &hash : queries)
+        {
+            sink += f(hash).hash().value();
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    auto lookups = static_cast<double>(queries.size()) * kRounds;
+    std::cout << name << ": " << static_cast<std::uint64_t>(lookups / elapsed.count())
+        << " lookups/s (checksum " << (sink & 0xffff) << ")" << std::endl;
+}
+} // namespace
+
+int main()
+{
+    icarus::InetAddress self_addr("127.0.0.1", 5000);
+    FingerTable table(self_addr);
+    Node self(self_addr);
+
+    std::vector<Node> peers;
+    for (std::size_t i = 1; i <= kNodes; ++i)
+    {
+        peers.emplace_back(icarus::InetAddress("127.0.0.1", static_cast<std::uint16_t>(5000 + i)));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto &node : peers)
+    {
+        table.insert(node);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "insert: " << static_cast<std::uint64_t>(peers.size() / elapsed.count())
+        << " inserts/s" << std::endl;
+
+    /**
+     * the old layout: M full Node objects
+    */
+    std::vector<Node> fingers;
+    for (std::size_t i = 0; i < FingerTable::M; ++i)
+    {
+        fingers.push_back(table[i]);
+    }
+
+    std::mt19937_64 gen(42);
+    std::vector<HashType> queries;
+    queries.reserve(kQueries);
+    for (std::size_t i = 0; i < kQueries; ++i)
+    {
+        queries.emplace_back(gen());
+    }
+
+    report("find_closest_pre (linear)", [&] (const HashType &hash) -> const Node &
+    {
+        return linear_closest_pre(fingers, self, hash);
+    }, queries);
+    report("find_closest_pre (table) ", [&] (const HashType &hash) -> const Node &
+    {
+        return table.find_closest_pre(hash);
+    }, queries);
+    report("find_closest_suc (linear)", [&] (const HashType &hash) -> const Node &
+    {
+        return linear_closest_suc(fingers, self, hash);
+    }, queries);
+    report("find_closest_suc (table) ", [&] (const HashType &hash) -> const Node &
+    {
+        return table.find_closest_suc(hash);
+    }, queries);
+
+    return 0;
+}
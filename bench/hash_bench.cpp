@@ -0,0 +1,116 @@
+#include "hasher.hpp"
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+using namespace chord;
+
+namespace
+{
+constexpr std::size_t kKeys = 1 << 20;
+constexpr std::size_t kNodes = 64;
+constexpr std::size_t kBuckets = 1024;
+
+using HashFunction = std::function<std::uint64_t(std::string_view)>;
+
+void report_speed(const char *name, const HashFunction &f, const std::vector<std::string> &keys)
+{
+    std::uint64_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto &key : keys)
+    {
+        sink += f(key);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << ": " << static_cast<std::uint64_t>(keys.size() / elapsed.count())
+        << " keys/s (checksum " << (sink & 0xffff) << ")" << std::endl;
+}
+
+/**
+ * chi-square of the keys over equal arcs of the ring,
+ *  about kBuckets - 1 for a uniform hash
+ *
+ * and the load of the nodes, each of them owns the keys up to its id
+*/
+void report_uniformity(const char *name, const HashFunction &f, const std::vector<std::string> &keys)
+{
+    std::vector<std::uint64_t> buckets(kBuckets);
+    for (auto &key : keys)
+    {
+        ++buckets[f(key) / (UINT64_MAX / kBuckets + 1)];
+    }
+
+    double expected = static_cast<double>(keys.size()) / kBuckets;
+    double chi_square = 0;
+    for (auto count : buckets)
+    {
+        chi_square += (count - expected) * (count - expected) / expected;
+    }
+
+    std::vector<std::uint64_t> ids;
+    for (std::size_t i = 0; i < kNodes; ++i)
+    {
+        ids.push_back(f("10.0.0." + std::to_string(i + 1) + ":5000"));
+    }
+    std::sort(ids.begin(), ids.end());
+
+    std::vector<std::uint64_t> loads(kNodes);
+    for (auto &key : keys)
+    {
+        auto it = std::lower_bound(ids.begin(), ids.end(), f(key));
+        ++loads[it == ids.end() ? 0 : it - ids.begin()];
+    }
+
+    double mean = static_cast<double>(keys.size()) / kNodes;
+    double variance = 0;
+    for (auto load : loads)
+    {
+        variance += (load - mean) * (load - mean) / kNodes;
+    }
+    auto max_load = *std::max_element(loads.begin(), loads.end());
+
+    std::cout << name << ": chi-square " << static_cast<std::uint64_t>(chi_square)
+        << " over " << kBuckets << " arcs, node load max/mean " << max_load / mean
+        << " stddev/mean " << std::sqrt(variance) / mean << std::endl;
+}
+} // namespace
+
+int main()
+{
+    std::vector<std::string> keys;
+    keys.reserve(kKeys);
+    for (std::size_t i = 0; i < kKeys; ++i)
+    {
+        keys.push_back("file-" + std::to_string(i));
+    }
+
+    HashFunction std_hash = [] (std::string_view data)
+    {
+        return static_cast<std::uint64_t>(std::hash<std::string_view>{}(data));
+    };
+    HashFunction xxh64 = [] (std::string_view data)
+    {
+        return Hasher::xxh64(data);
+    };
+    HashFunction sha1 = [] (std::string_view data)
+    {
+        return Hasher::sha1(data);
+    };
+
+    report_speed("std::hash", std_hash, keys);
+    report_speed("xxh64    ", xxh64, keys);
+    report_speed("sha1     ", sha1, keys);
+
+    report_uniformity("std::hash", std_hash, keys);
+    report_uniformity("xxh64    ", xxh64, keys);
+    report_uniformity("sha1     ", sha1, keys);
+
+    return 0;
+}
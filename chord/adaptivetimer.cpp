@@ -0,0 +1,91 @@
+#include "adaptivetimer.hpp"
+
+#include <algorithm>
+
+namespace chord
+{
+AdaptiveTimer::AdaptiveTimer(icarus::EventLoop *loop, double min, double max, Task task)
+  : loop_(loop)
+  , task_(std::move(task))
+  , min_(min)
+  , max_(std::max(min, max))
+  , period_(min)
+  , running_(false)
+{
+    // ...
+}
+
+void AdaptiveTimer::start()
+{
+    if (running_)
+    {
+        return;
+    }
+
+    running_ = true;
+    period_ = min_;
+    schedule();
+}
+
+void AdaptiveTimer::stop()
+{
+    if (!running_)
+    {
+        return;
+    }
+
+    running_ = false;
+    loop_->cancel(timer_);
+}
+
+void AdaptiveTimer::tighten()
+{
+    if (!running_ || period_ == min_)
+    {
+        return;
+    }
+
+    period_ = min_;
+    loop_->cancel(timer_);
+    schedule();
+}
+
+void AdaptiveTimer::set_period(double min, double max)
+{
+    min_ = min;
+    max_ = std::max(min, max);
+    period_ = std::clamp(period_, min_, max_);
+}
+
+double AdaptiveTimer::period() const
+{
+    return period_;
+}
+
+void AdaptiveTimer::schedule()
+{
+    timer_ = loop_->run_after(period_, [this]
+    {
+        fire();
+    });
+}
+
+void AdaptiveTimer::fire()
+{
+    if (!running_)
+    {
+        return;
+    }
+
+    auto changed = task_();
+    period_ = changed ? min_ : std::min(period_ * kBackoff, max_);
+
+    /**
+     * the task may have stopped the timer
+    */
+    if (running_)
+    {
+        schedule();
+    }
+}
+} // namespace chord
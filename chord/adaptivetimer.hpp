@@ -0,0 +1,61 @@
+#ifndef __CHORD_ADAPTIVETIMER_HPP__
+#define __CHORD_ADAPTIVETIMER_HPP__
+
+#include <functional>
+#include <icarus/timerid.hpp>
+#include <icarus/eventloop.hpp>
+
+namespace chord
+{
+/**
+ * run a task periodically in a loop,
+ *  the period doubles from min up to max after each quiet round
+ *  and falls back to min once the task reports a change
+ *
+ * all the methods must be called in the loop
+*/
+class AdaptiveTimer
+{
+  public:
+    static constexpr double kBackoff = 2;
+
+    /**
+     * return true if something has changed since the last run
+    */
+    using Task = std::function<bool()>;
+
+  public:
+    AdaptiveTimer(icarus::EventLoop *loop, double min, double max, Task task);
+
+    AdaptiveTimer(const AdaptiveTimer &) = delete;
+    AdaptiveTimer &operator=(const AdaptiveTimer &) = delete;
+
+    void start();
+    void stop();
+    /**
+     * run at the min period from now on,
+     *  the pending run is brought forward if it's later than that
+    */
+    void tighten();
+
+    void set_period(double min, double max);
+    double period() const;
+
+  private:
+    void schedule();
+    void fire();
+
+  private:
+    icarus::EventLoop *loop_;
+    Task task_;
+
+    double min_;
+    double max_;
+    double period_;
+
+    bool running_;
+    icarus::TimerId timer_;
+};
+} // namespace chord
+
+#endif
@@ -1,191 +1,318 @@
+#include "store.hpp"
 #include "client.hpp"
+#include "connectionpool.hpp"
 
-#include <thread>
-#include <icarus/buffer.hpp>
-#include <icarus/callbacks.hpp>
-#include <icarus/tcpclient.hpp>
-#include <icarus/eventloop.hpp>
+#include <fcntl.h>
+#include <future>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/stat.h>
 
 namespace chord
 {
-Client::Client(icarus::InetAddress server_addr)
-  : keep_wait_(true)
+Client::Client(ConnectionPool &pool, icarus::InetAddress server_addr)
+  : stream_id_(0)
+  , cancelled_(false)
+  , keep_wait_(true)
+  , timeout_(0)
   , server_addr_(server_addr)
+  , pool_(pool)
 {
     // ...
 }
 
-Client::Client(icarus::InetAddress server_addr,
-    std::chrono::seconds time)
-  : keep_wait_(false)
+Client::Client(ConnectionPool &pool, icarus::InetAddress server_addr,
+    std::chrono::milliseconds time)
+  : stream_id_(0)
+  , cancelled_(false)
+  , keep_wait_(false)
   , timeout_(time)
   , server_addr_(server_addr)
+  , pool_(pool)
 {
     // ...
 }
 
 void Client::send(const Message &msg)
 {
-    std::thread send_thread([server_addr = server_addr_, msg]
-    {
-        icarus::EventLoop loop;
-        icarus::TcpClient client(&loop, server_addr, "chord client");
-
-        client.set_connection_callback([&msg, &loop] (const icarus::TcpConnectionPtr &conn)
-        {
-            if (conn->connected())
-            {
-                conn->send(msg.to_str());
-                conn->shutdown();
-            }
-            else
-            {
-                loop.quit();
-            }
-        });
-
-        client.connect();
-        /**
-         * loop may not stop
-         *  but this will be blocked by os
-        */
-        loop.loop();
-    });
-    send_thread.detach();
+    pool_.post(server_addr_, msg);
 }
 
 std::optional<Message>
 Client::send_and_wait_response(const Message &msg)
 {
-    std::optional<Message> result;
+    std::promise<std::optional<Message>> promise;
+    auto future = promise.get_future();
+
+    /**
+     * zero timeout lets the pool wait until the peer answers
+    */
+    auto timeout = keep_wait_ ? std::chrono::milliseconds(0) : timeout_;
+    pool_.call(server_addr_, msg, timeout, [&promise] (const std::optional<Message> &result)
+    {
+        promise.set_value(result);
+    });
 
-    std::thread send_thread([this, &msg, &result]
+    return future.get();
+}
+
+void Client::send_and_wait_response(const Message &msg, TimeoutCallback callback)
+{
+    auto timeout = keep_wait_ ? std::chrono::milliseconds(0) : timeout_;
+    pool_.call(server_addr_, msg, timeout, [callback = std::move(callback)] (const std::optional<Message> &result)
     {
-        enum State
+        callback(!result.has_value(), result);
+    });
+}
+
+bool Client::send_and_wait_stream(const Message &msg, std::ostream &out)
+{
+    bool receive_stream = false;
+    std::promise<void> promise;
+    auto future = promise.get_future();
+
+    pool_.stream(server_addr_, msg,
+        [&out, &receive_stream] (const char *data, std::size_t len)
+        {
+            out.write(data, len);
+            receive_stream = true;
+        },
+        [&promise]
         {
-            Connected,
-            DisConnected,
-        };
+            promise.set_value();
+        }
+    );
+    future.wait();
 
-        State state = DisConnected;
+    return receive_stream;
+}
 
-        icarus::EventLoop loop;
-        icarus::TcpClient client(&loop, server_addr_, "chord client");
+std::optional<std::size_t> Client::fetch(const Message &msg, DataSink sink, ObjectInfo *object)
+{
+    /**
+     * only touched in the loop of the pool until the promise is set
+    */
+    std::size_t received = 0;
+    bool complete = false;
+    std::promise<void> promise;
+    auto future = promise.get_future();
 
-        client.set_connection_callback([&msg, &state, &loop] (const icarus::TcpConnectionPtr &conn)
+    if (cancelled_)
+    {
+        return {};
+    }
+
+    auto id = pool_.fetch(server_addr_, msg,
+        [&sink, &received, &complete, object] (const MessageView &frame)
         {
-            if (conn->connected())
+            if (frame.type() == Message::Data)
             {
-                state = Connected;
-                conn->send(msg.to_str());
-                conn->shutdown();
+                auto data = frame[0];
+                if (!sink(data.data(), data.size()))
+                {
+                    return false;
+                }
+                received += data.size();
+                return true;
             }
-            else
+
+            complete = frame.type() == Message::DataEnd
+                && frame.param_as_flag(1)
+                && frame.param_as_number(0) == received;
+            if (complete && object != nullptr && frame.size() >= 3)
             {
-                loop.quit();
+                object->size = frame.param_as_number(2);
             }
-        });
-
-        if (keep_wait_)
-        {
-            client.set_message_callback([&result, &loop] (const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
+            if (complete && object != nullptr && frame.size() >= 5)
             {
-                if (buf->findCRLF() == nullptr)
-                {
-                    return;
-                }
+                object->version = frame.param_as_number(3);
+                object->checksum = static_cast<std::uint32_t>(frame.param_as_number(4));
+            }
+            return false;
+        },
+        [&promise]
+        {
+            promise.set_value();
+        }
+    );
 
-                result = Message::parse(buf);
-                loop.quit();
-            });
+    /**
+     * either this or cancel sees the other
+    */
+    stream_id_ = id;
+    if (cancelled_)
+    {
+        pool_.cancel(id);
+    }
+    future.wait();
+    stream_id_ = 0;
 
-            client.connect();
-            loop.loop();
-        }
-        else
+    if (!complete)
+    {
+        return {};
+    }
+    return received;
+}
+
+void Client::cancel()
+{
+    cancelled_ = true;
+    if (auto id = stream_id_.load())
+    {
+        pool_.cancel(id);
+    }
+}
+
+std::optional<ObjectInfo> Client::probe(const std::string &filename, std::uint64_t version)
+{
+    /**
+     * a peer which ignores the range sends the whole object,
+     *  which is cut off at its first chunk
+    */
+    ObjectInfo object;
+    object.size = UINT64_MAX;
+    auto size = fetch(Message(Message::Fetch, filename).add_number(0).add_number(0).add_number(version),
+        [] (const char *, std::size_t)
         {
-            client.set_message_callback([&result, &loop] (const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
-            {
-                if (buf->findCRLF() == nullptr)
-                {
-                    return;
-                }
+            return false;
+        },
+        &object
+    );
+    if (!size.has_value() || object.size == UINT64_MAX || object.version != version)
+    {
+        return {};
+    }
+    return object;
+}
+
+std::optional<std::size_t> Client::fetch_file(const std::string &filename, const std::string &path,
+    std::uint64_t length, ObjectInfo *object)
+{
+    auto part = path + ".part";
+    int fd = ::open(part.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return {};
+    }
 
-                result = Message::parse(buf);
-                loop.quit();
-            });
+    struct stat st;
+    std::uint64_t have = ::fstat(fd, &st) == 0 ? static_cast<std::uint64_t>(st.st_size) : 0;
 
-            std::thread timer([&state, &loop, &client, time = timeout_]
-            {
-                auto start = std::chrono::high_resolution_clock::now();
-                while (std::chrono::high_resolution_clock::now() - start < time)
-                {
-                    if (state == Connected)
-                    {
-                        break;
-                    }
-                }
+    ObjectInfo whole;
+    bool mismatch = false;
+    auto size = fetch_part(fd, filename, have, length, whole, mismatch);
+    if (mismatch)
+    {
+        std::cout << "[RESUME] " << part << " is not a part of " << filename << " anymore" << std::endl;
+        whole = ObjectInfo();
+        mismatch = false;
+        size = ::ftruncate(fd, 0) == 0
+            ? fetch_part(fd, filename, 0, length, whole, mismatch) : std::nullopt;
+    }
 
-                if (state == DisConnected)
-                {
-                    client.stop();
-                    /**
-                     * wait client stoped
-                    */
-                    std::this_thread::sleep_for(std::chrono::seconds(1));
-                    loop.quit();
-                }
-            });
+    /**
+     * a peer which doesn't serve ranges doesn't tell the size either,
+     *  and what it sends is the whole
+    */
+    if (size.has_value())
+    {
+        whole.size = std::max<std::uint64_t>(whole.size, size.value());
+    }
 
-            client.connect();
-            loop.loop();
-            timer.join();
+    /**
+     * the bytes resumed from the part were only compared at its end
+    */
+    if (size.has_value() && whole.size == size.value() && whole.version != 0
+        && Store::crc32(fd, whole.size) != whole.checksum)
+    {
+        std::cout << "[GET] " << part << " doesn't match the checksum of " << filename << std::endl;
+        if (::ftruncate(fd, 0) != 0)
+        {
+            std::cout << "[GET] Cannot drop " << part << std::endl;
         }
-    });
-    send_thread.join();
+        size.reset();
+    }
+    ::close(fd);
 
-    return result;
+    if (!size.has_value())
+    {
+        return {};
+    }
+    if (object != nullptr)
+    {
+        *object = whole;
+    }
+    if (whole.size > size.value())
+    {
+        return size;
+    }
+    if (std::rename(part.c_str(), path.c_str()) != 0)
+    {
+        return {};
+    }
+    return size;
 }
 
-bool Client::send_and_wait_stream(const Message &msg, std::ostream &out)
+std::optional<std::size_t> Client::fetch_part(int fd, const std::string &filename, std::uint64_t have,
+    std::uint64_t length, ObjectInfo &whole, bool &mismatch)
 {
-    bool receive_stream = false;
-
-    std::thread send_thread([this, &msg, &out, &receive_stream]
-    {
-        icarus::EventLoop loop;
-        icarus::TcpClient client(&loop, server_addr_, "chord client");
+    auto from = have > kResumeOverlap ? have - kResumeOverlap : 0;
+    auto end = length == UINT64_MAX ? UINT64_MAX : std::max(length, have);
 
-        client.set_connection_callback([&msg, &loop] (const icarus::TcpConnectionPtr &conn)
+    std::uint64_t offset = from;
+    std::vector<char> local;
+    auto size = fetch(Message(Message::Fetch, filename)
+        .add_number(from).add_number(end == UINT64_MAX ? UINT64_MAX : end - from),
+        [fd, have, &offset, &local, &mismatch] (const char *data, std::size_t len)
         {
-            if (conn->connected())
+            /**
+             * the bytes already in the part are compared rather than written
+            */
+            if (offset < have)
             {
-                conn->send(msg.to_str());
-                conn->shutdown();
+                auto overlap = static_cast<std::size_t>(std::min<std::uint64_t>(len, have - offset));
+                local.resize(overlap);
+                if (::pread(fd, local.data(), overlap, static_cast<off_t>(offset)) != static_cast<ssize_t>(overlap)
+                    || std::memcmp(local.data(), data, overlap) != 0)
+                {
+                    mismatch = true;
+                    return false;
+                }
+                offset += overlap;
+                data += overlap;
+                len -= overlap;
             }
-            else
+
+            if (len > 0 && ::pwrite(fd, data, len, static_cast<off_t>(offset)) != static_cast<ssize_t>(len))
             {
-                loop.quit();
+                return false;
             }
-        });
-
-        client.set_message_callback([&out, &receive_stream, &loop] (const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
-        {
-            out.write(buf->peek(), buf->readable_bytes());
-            buf->retrieve_all();
-
-            receive_stream = true;
-        });
-
-        client.connect();
-        loop.loop();
-    });
-    send_thread.join();
+            offset += len;
+            return true;
+        },
+        &whole
+    );
+    if (!size.has_value())
+    {
+        return {};
+    }
 
-    return receive_stream;
+    /**
+     * the part is longer than the object,
+     *  or the peer sent the whole object rather than the range
+    */
+    if (offset < have || (from > 0 && whole.size == 0))
+    {
+        mismatch = true;
+        return {};
+    }
+    return offset;
 }
 
-void Client::set_timeout(std::chrono::seconds time)
+void Client::set_timeout(std::chrono::milliseconds time)
 {
     keep_wait_ = false;
     timeout_ = time;
@@ -3,6 +3,8 @@
 
 #include "message.hpp"
 
+#include <atomic>
+#include <string>
 #include <chrono>
 #include <iostream>
 #include <optional>
@@ -12,19 +14,47 @@
 
 namespace chord
 {
+class ConnectionPool;
 using TimeoutCallback = std::function<void(bool timeout, const std::optional<Message> &result)>;
 /**
- * wrapper of TcpClient
+ * return false to abort the transfer
+*/
+using DataSink = std::function<bool(const char *data, std::size_t len)>;
+/**
+ * the whole object as told by the DataEnd of a fetch,
+ *  the version and the checksum are 0 if it's not served from a store
+*/
+struct ObjectInfo
+{
+    std::uint64_t size = 0;
+    std::uint64_t version = 0;
+    std::uint32_t checksum = 0;
+};
+/**
+ * wrapper of the pooled connections to one peer
  *  provide the timeout scheme
+ *
+ * the blocking methods must not be called in the loop of the pool
 */
 class Client
 {
   public:
-    Client(icarus::InetAddress server_addr);
-    Client(icarus::InetAddress server_addr, std::chrono::seconds time);
+    /**
+     * the bytes at the end of a part which are fetched again
+     *  and compared before it's resumed
+    */
+    static constexpr std::size_t kResumeOverlap = 64 * 1024;
+
+  public:
+    Client(ConnectionPool &pool, icarus::InetAddress server_addr);
+    /**
+     * the timeout of each request sent by this client,
+     *  seconds convert to it implicitly
+    */
+    Client(ConnectionPool &pool, icarus::InetAddress server_addr, std::chrono::milliseconds time);
 
     /**
-     * just send msg in a detached thread
+     * just send msg through an idle connection
      *  and don't care it is successful or not
     */
     void send(const Message &msg);
@@ -35,17 +65,69 @@ class Client
     std::optional<Message>
     send_and_wait_response(const Message &msg);
     /**
-     * not care about timeout
+     * return at once, the callback is called in the loop of the pool
+     *  so it must not block or wait for another response
+    */
+    void send_and_wait_response(const Message &msg, TimeoutCallback callback);
+    /**
+     * not care about timeout,
+     *  only a stream which stalls is closed by the pool
     */
     bool send_and_wait_stream(const Message &msg, std::ostream &out);
+    /**
+     * receive an object in Data frames and pass them to the sink
+     *  in the loop of the pool, return its size
+     *  or nothing if it's not found, truncated, aborted
+     *  or stalled, see ConnectionPool::stream
+    */
+    std::optional<std::size_t> fetch(const Message &msg, DataSink sink, ObjectInfo *object = nullptr);
+    /**
+     * abort the fetch in progress from another thread,
+     *  and the ones after it, which return nothing at once
+    */
+    void cancel();
+    /**
+     * the version of an object in the store of the peer by asking for none of it,
+     *  or nothing if the peer doesn't have it or doesn't serve ranges
+    */
+    std::optional<ObjectInfo> probe(const std::string &filename, std::uint64_t version);
+    /**
+     * the object is written to path.part first
+     *  and renamed to path only after the whole of it arrives,
+     *  return the bytes in either of them
+     *
+     * a part left by an interrupted fetch is resumed from its end,
+     *  once its last kResumeOverlap bytes are found to be the same at the peer,
+     *  otherwise the object is fetched again from the start
+     *
+     * if only the first length bytes are asked and the whole is larger,
+     *  they are left in path.part and the whole is described in object,
+     *  see StripedFetch
+     *
+     * an object from a store is renamed only if its checksum matches,
+     *  otherwise the part is cut to be fetched again from the start
+    */
+    std::optional<std::size_t> fetch_file(const std::string &filename, const std::string &path,
+        std::uint64_t length = UINT64_MAX, ObjectInfo *object = nullptr);
 
-    void set_timeout(std::chrono::seconds time);
+    void set_timeout(std::chrono::milliseconds time);
     void keep_wait();
 
   private:
+    /**
+     * fetch the object from the end of the part in fd, up to length,
+     *  return the end of what is verified or written
+    */
+    std::optional<std::size_t> fetch_part(int fd, const std::string &filename, std::uint64_t have,
+        std::uint64_t length, ObjectInfo &whole, bool &mismatch);
+
+  private:
+    std::atomic<std::uint64_t> stream_id_;
+    std::atomic<bool> cancelled_;
     bool keep_wait_;
-    std::chrono::seconds timeout_;
+    std::chrono::milliseconds timeout_;
     icarus::InetAddress server_addr_;
+    ConnectionPool &pool_;
 };
 } // namespace chord
 
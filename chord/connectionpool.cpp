@@ -0,0 +1,727 @@
+#include "hasher.hpp"
+#include "metrics.hpp"
+#include "connectionpool.hpp"
+
+#include <algorithm>
+#include <icarus/buffer.hpp>
+#include <icarus/tcpconnection.hpp>
+
+namespace chord
+{
+namespace
+{
+/**
+ * TcpClient keeps retrying an unreachable peer
+ *  so a connection which is not established in time is given up
+*/
+constexpr std::chrono::seconds kConnectTimeout(3);
+constexpr std::chrono::seconds kEvictInterval(1);
+/**
+ * a stream which receives nothing for so long is given up,
+ *  the data of a live one comes in far shorter gaps
+*/
+constexpr std::chrono::seconds kStreamTimeout(10);
+/**
+ * peers which don't answer Hello in time are spoken to in text
+ *  on that connection, and asked again on the next one
+*/
+constexpr std::chrono::seconds kHelloTimeout(1);
+
+/**
+ * the timers of the loop take seconds
+*/
+template <typename Rep, typename Period>
+double seconds_of(std::chrono::duration<Rep, Period> time)
+{
+    return std::chrono::duration<double>(time).count();
+}
+} // namespace
+
+struct ConnectionPool::Channel
+{
+    enum State
+    {
+        Connecting,
+        Idle,
+        Busy,
+        Closed,
+    };
+
+    Channel(icarus::EventLoop *loop, const icarus::InetAddress &addr)
+      : key(addr.to_ip_port())
+      , addr(addr)
+      , client(loop, addr, "chord client")
+      , state(Connecting)
+      , reused(false)
+      , binary(false)
+      , hello_pending(false)
+      , request_id(0)
+      , last_used(std::chrono::steady_clock::now())
+    {
+        // ...
+    }
+
+    std::string key;
+    icarus::InetAddress addr;
+    icarus::TcpClient client;
+    icarus::TcpConnectionPtr conn;
+
+    State state;
+    bool reused;
+    bool binary;
+    bool hello_pending;
+    std::optional<Request> request;
+    std::uint64_t request_id;
+    std::optional<icarus::TimerId> deadline_timer;
+    std::chrono::steady_clock::time_point last_used;
+};
+
+struct ConnectionPool::Stream
+{
+    Stream(icarus::EventLoop *loop, const icarus::InetAddress &addr, StreamId id)
+      : id(id)
+      , client(loop, addr, "chord stream")
+      , closed(false)
+    {
+        // ...
+    }
+
+    StreamId id;
+    icarus::TcpClient client;
+    icarus::TcpConnectionPtr conn;
+    std::chrono::steady_clock::time_point last_active;
+    std::optional<icarus::TimerId> idle_timer;
+    /**
+     * raw data or frames, only one of them is set
+    */
+    DataCallback on_data;
+    FrameCallback on_frame;
+    CloseCallback on_close;
+    bool closed;
+};
+
+ConnectionPool::ConnectionPool(icarus::EventLoop *loop)
+  : loop_(loop)
+  , idle_timeout_(30)
+  , max_idle_per_peer_(4)
+  , next_request_id_(0)
+  , next_stream_id_(0)
+{
+    evict_timer_ = loop_->run_every(seconds_of(kEvictInterval), [this]
+    {
+        this->evict_idle();
+    });
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    loop_->cancel(evict_timer_);
+}
+
+void ConnectionPool::post(const icarus::InetAddress &addr, const Message &msg)
+{
+    loop_->run_in_loop([this, addr, msg]
+    {
+        dispatch(addr, Request{msg, false, std::chrono::steady_clock::time_point::max(),
+            nullptr, false, std::chrono::steady_clock::now()});
+    });
+}
+
+void ConnectionPool::call(const icarus::InetAddress &addr, const Message &msg,
+    std::chrono::milliseconds timeout, ResponseCallback callback)
+{
+    /**
+     * the deadline counts from the call,
+     *  not from when the loop gets to it
+    */
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = timeout.count() > 0 ? start + timeout : std::chrono::steady_clock::time_point::max();
+    loop_->run_in_loop([this, addr, msg, deadline, start, callback = std::move(callback)]
+    {
+        dispatch(addr, Request{msg, true, deadline, callback, false, start});
+    });
+}
+
+void ConnectionPool::stream(const icarus::InetAddress &addr, const Message &msg,
+    DataCallback on_data, CloseCallback on_close)
+{
+    loop_->run_in_loop([this, addr, msg, id = ++next_stream_id_,
+        on_data = std::move(on_data), on_close = std::move(on_close)]
+    {
+        auto stream = std::make_shared<Stream>(loop_, addr, id);
+        stream->on_data = on_data;
+        stream->on_close = on_close;
+        open_stream(stream, msg.to_str());
+    });
+}
+
+ConnectionPool::StreamId ConnectionPool::fetch(const icarus::InetAddress &addr, const Message &msg,
+    FrameCallback on_frame, CloseCallback on_close)
+{
+    auto id = ++next_stream_id_;
+    loop_->run_in_loop([this, addr, msg, id,
+        on_frame = std::move(on_frame), on_close = std::move(on_close)]
+    {
+        auto stream = std::make_shared<Stream>(loop_, addr, id);
+        stream->on_frame = on_frame;
+        stream->on_close = on_close;
+        open_stream(stream, msg.to_frame());
+    });
+    return id;
+}
+
+/**
+ * the stream is opened in the loop too,
+ *  so it's there unless it's over, once the id is known
+*/
+void ConnectionPool::cancel(StreamId id)
+{
+    loop_->run_in_loop([this, id]
+    {
+        auto it = streams_.find(id);
+        if (it == streams_.end())
+        {
+            return;
+        }
+
+        auto stream = it->second;
+        if (stream->conn)
+        {
+            stream->conn->force_close();
+        }
+        else
+        {
+            stream->client.stop();
+        }
+        close_stream(stream);
+    });
+}
+
+void ConnectionPool::set_idle_timeout(std::chrono::seconds time)
+{
+    idle_timeout_ = time;
+}
+
+void ConnectionPool::set_max_idle_per_peer(std::size_t num)
+{
+    max_idle_per_peer_ = num;
+}
+
+icarus::EventLoop *ConnectionPool::loop() const
+{
+    return loop_;
+}
+
+void ConnectionPool::dispatch(const icarus::InetAddress &addr, Request req)
+{
+    auto id = ++next_request_id_;
+    auto expect_response = req.expect_response;
+    auto deadline = req.deadline;
+
+    auto channel = acquire(addr);
+    channel->request = std::move(req);
+    channel->request_id = id;
+
+    if (expect_response && deadline != std::chrono::steady_clock::time_point::max())
+    {
+        auto left = std::max(deadline - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+        ChannelWeakPtr weak = channel;
+        channel->deadline_timer = loop_->run_after(seconds_of(left), [this, weak, id]
+        {
+            auto channel = weak.lock();
+            if (!channel || !channel->request || channel->request_id != id)
+            {
+                return;
+            }
+
+            /**
+             * the answer may still arrive later,
+             *  so the connection cannot be reused anymore
+            */
+            auto req = std::move(*channel->request);
+            channel->request.reset();
+            channel->deadline_timer.reset();
+            close(channel);
+            Metrics::instance().request_timeouts.add();
+            req.callback({});
+        });
+    }
+
+    if (channel->state == Channel::Idle)
+    {
+        start_request(channel);
+    }
+}
+
+void ConnectionPool::start_request(const ChannelPtr &channel)
+{
+    channel->state = Channel::Busy;
+    channel->conn->send(channel->request->msg.encode(channel->binary));
+
+    if (!channel->request->expect_response)
+    {
+        channel->request.reset();
+        release(channel);
+    }
+}
+
+void ConnectionPool::finish_request(const ChannelPtr &channel, const std::optional<Message> &result)
+{
+    auto req = std::move(*channel->request);
+    channel->request.reset();
+    cancel_deadline(channel);
+    release(channel);
+
+    Metrics::instance().request_time[req.msg.type()].observe(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - req.start
+    ).count());
+    req.callback(result);
+}
+
+/**
+ * the timer would find the request gone anyway,
+ *  but it's dropped so that the timers don't pile up in the loop
+*/
+void ConnectionPool::cancel_deadline(const ChannelPtr &channel)
+{
+    if (channel->deadline_timer.has_value())
+    {
+        loop_->cancel(channel->deadline_timer.value());
+        channel->deadline_timer.reset();
+    }
+}
+
+ConnectionPool::ChannelPtr ConnectionPool::acquire(const icarus::InetAddress &addr)
+{
+    auto it = peers_.find(addr.to_ip_port());
+    if (it != peers_.end())
+    {
+        for (auto &channel : it->second)
+        {
+            if (channel->state == Channel::Idle)
+            {
+                channel->reused = true;
+                return channel;
+            }
+        }
+    }
+
+    return connect(addr);
+}
+
+ConnectionPool::ChannelPtr ConnectionPool::connect(const icarus::InetAddress &addr)
+{
+    auto channel = std::make_shared<Channel>(loop_, addr);
+    peers_[channel->key].push_back(channel);
+
+    ChannelWeakPtr weak = channel;
+    channel->client.set_connection_callback([this, weak] (const icarus::TcpConnectionPtr &conn)
+    {
+        on_connection(weak, conn);
+    });
+    channel->client.set_message_callback([this, weak] (const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
+    {
+        on_message(weak, buf);
+    });
+
+    loop_->run_after(seconds_of(kConnectTimeout), [this, weak]
+    {
+        auto channel = weak.lock();
+        if (channel && channel->state == Channel::Connecting)
+        {
+            abort(channel);
+        }
+    });
+
+    channel->client.connect();
+    return channel;
+}
+
+/**
+ * put the channel back for reuse
+ *  unless there are already enough idle ones to the peer
+*/
+void ConnectionPool::release(const ChannelPtr &channel)
+{
+    channel->state = Channel::Idle;
+    channel->last_used = std::chrono::steady_clock::now();
+
+    auto &channels = peers_[channel->key];
+    auto idle = std::count_if(channels.begin(), channels.end(), [] (const ChannelPtr &ch)
+    {
+        return ch->state == Channel::Idle;
+    });
+    if (static_cast<std::size_t>(idle) > max_idle_per_peer_)
+    {
+        close(channel);
+    }
+}
+
+void ConnectionPool::close(const ChannelPtr &channel)
+{
+    if (channel->state == Channel::Closed)
+    {
+        return;
+    }
+
+    channel->state = Channel::Closed;
+    if (channel->conn)
+    {
+        channel->conn->force_close();
+    }
+    else
+    {
+        channel->client.stop();
+    }
+
+    auto it = peers_.find(channel->key);
+    if (it != peers_.end())
+    {
+        auto &channels = it->second;
+        channels.erase(std::remove(channels.begin(), channels.end(), channel), channels.end());
+        if (channels.empty())
+        {
+            peers_.erase(it);
+        }
+    }
+
+    /**
+     * the client may be still in its own callbacks,
+     *  destroy it in the next round of the loop
+    */
+    loop_->queue_in_loop([channel] {});
+}
+
+/**
+ * close the channel and fail its request
+*/
+void ConnectionPool::abort(const ChannelPtr &channel)
+{
+    std::optional<Request> req;
+    req.swap(channel->request);
+    cancel_deadline(channel);
+    close(channel);
+
+    if (req.has_value() && req->expect_response)
+    {
+        Metrics::instance().request_failures.add();
+        req->callback({});
+    }
+}
+
+/**
+ * send the request waiting for the connection, if any
+*/
+void ConnectionPool::proceed(const ChannelPtr &channel)
+{
+    if (channel->request.has_value())
+    {
+        start_request(channel);
+    }
+    else
+    {
+        release(channel);
+    }
+}
+
+/**
+ * ask the peer whether it speaks binary frames,
+ *  only an answer is remembered for later connections to it,
+ *  as a timeout may only mean the peer was busy
+*/
+void ConnectionPool::say_hello(const ChannelPtr &channel)
+{
+    channel->hello_pending = true;
+    channel->conn->send(Message(Message::Hello, MessageView::kVersion)
+        .add_number(Hasher::algorithm()).to_str());
+
+    ChannelWeakPtr weak = channel;
+    loop_->run_after(seconds_of(kHelloTimeout), [this, weak]
+    {
+        auto channel = weak.lock();
+        if (channel && channel->hello_pending && channel->state != Channel::Closed)
+        {
+            on_hello(channel, {});
+        }
+    });
+}
+
+void ConnectionPool::on_hello(const ChannelPtr &channel, const std::optional<Message> &result)
+{
+    channel->hello_pending = false;
+    channel->binary = result.has_value() && result->type() == Message::Hello
+        && result->param_as_number() >= 1;
+    if (result.has_value())
+    {
+        binary_peers_[channel->key] = channel->binary;
+    }
+
+    proceed(channel);
+}
+
+void ConnectionPool::on_connection(const ChannelWeakPtr &weak, const icarus::TcpConnectionPtr &conn)
+{
+    auto channel = weak.lock();
+    if (!channel || channel->state == Channel::Closed)
+    {
+        return;
+    }
+
+    if (conn->connected())
+    {
+        channel->conn = conn;
+
+        auto it = binary_peers_.find(channel->key);
+        if (it == binary_peers_.end())
+        {
+            say_hello(channel);
+            return;
+        }
+        channel->binary = it->second;
+        proceed(channel);
+        return;
+    }
+
+    /**
+     * closed by the peer
+    */
+    std::optional<Request> req;
+    req.swap(channel->request);
+    cancel_deadline(channel);
+    channel->conn.reset();
+    close(channel);
+
+    if (!req.has_value())
+    {
+        return;
+    }
+    if (channel->reused && !req->retried)
+    {
+        req->retried = true;
+        dispatch(channel->addr, std::move(*req));
+    }
+    else if (req->expect_response)
+    {
+        Metrics::instance().request_failures.add();
+        req->callback({});
+    }
+}
+
+void ConnectionPool::on_message(const ChannelWeakPtr &weak, icarus::Buffer *buf)
+{
+    auto channel = weak.lock();
+    if (!channel || channel->state == Channel::Closed)
+    {
+        buf->retrieve_all();
+        return;
+    }
+
+    while (buf->readable_bytes() > 0 && channel->state != Channel::Closed)
+    {
+        std::optional<Message> result;
+        if (MessageView::is_frame(buf))
+        {
+            bool malformed = false;
+            auto view = MessageView::parse(buf, malformed);
+            if (malformed)
+            {
+                buf->retrieve_all();
+                abort(channel);
+                return;
+            }
+            if (!view.has_value())
+            {
+                return;
+            }
+
+            result.emplace(view.value());
+            buf->retrieve(view->frame_size());
+        }
+        else
+        {
+            if (buf->findCRLF() == nullptr)
+            {
+                return;
+            }
+            result = Message::parse(buf);
+        }
+
+        if (channel->hello_pending)
+        {
+            on_hello(channel, result);
+        }
+        else if (result.has_value() && result->type() == Message::Hello
+            && !(channel->request.has_value() && channel->request->msg.type() == Message::Hello))
+        {
+            /**
+             * the answer to a Hello which timed out,
+             *  it's not the response of the request
+            */
+            binary_peers_[channel->key] = result->param_as_number() >= 1;
+        }
+        else if (channel->request.has_value() && channel->request->expect_response)
+        {
+            finish_request(channel, result);
+        }
+    }
+}
+
+void ConnectionPool::evict_idle()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    std::vector<ChannelPtr> expired;
+    for (auto &[key, channels] : peers_)
+    {
+        for (auto &channel : channels)
+        {
+            if (channel->state == Channel::Idle && now - channel->last_used > idle_timeout_)
+            {
+                expired.push_back(channel);
+            }
+        }
+    }
+
+    for (auto &channel : expired)
+    {
+        close(channel);
+    }
+}
+
+void ConnectionPool::open_stream(const StreamPtr &stream, const std::string &request)
+{
+    streams_[stream->id] = stream;
+
+    std::weak_ptr<Stream> weak = stream;
+    stream->client.set_connection_callback([this, weak, request] (const icarus::TcpConnectionPtr &conn)
+    {
+        auto stream = weak.lock();
+        if (!stream)
+        {
+            return;
+        }
+
+        if (conn->connected())
+        {
+            stream->conn = conn;
+            stream->last_active = std::chrono::steady_clock::now();
+            watch_stream(stream);
+            conn->send(request);
+        }
+        else
+        {
+            stream->conn.reset();
+            close_stream(stream);
+        }
+    });
+    stream->client.set_message_callback([this, weak] (const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
+    {
+        auto stream = weak.lock();
+        if (!stream || stream->closed)
+        {
+            buf->retrieve_all();
+            return;
+        }
+        on_stream_message(stream, buf);
+    });
+
+    loop_->run_after(seconds_of(kConnectTimeout), [this, weak]
+    {
+        auto stream = weak.lock();
+        if (stream && !stream->conn && !stream->closed)
+        {
+            stream->client.stop();
+            close_stream(stream);
+        }
+    });
+
+    stream->client.connect();
+}
+
+/**
+ * one timer for each stream which is put off by the data,
+ *  rather than one for each chunk
+*/
+void ConnectionPool::watch_stream(const StreamPtr &stream)
+{
+    auto left = stream->last_active + kStreamTimeout - std::chrono::steady_clock::now();
+    std::weak_ptr<Stream> weak = stream;
+    stream->idle_timer = loop_->run_after(seconds_of(std::max(left, std::chrono::steady_clock::duration::zero())),
+        [this, weak]
+        {
+            auto stream = weak.lock();
+            if (!stream || stream->closed)
+            {
+                return;
+            }
+
+            stream->idle_timer.reset();
+            if (std::chrono::steady_clock::now() - stream->last_active < kStreamTimeout)
+            {
+                watch_stream(stream);
+                return;
+            }
+
+            Metrics::instance().request_timeouts.add();
+            if (stream->conn)
+            {
+                stream->conn->force_close();
+            }
+            close_stream(stream);
+        }
+    );
+}
+
+void ConnectionPool::on_stream_message(const StreamPtr &stream, icarus::Buffer *buf)
+{
+    stream->last_active = std::chrono::steady_clock::now();
+    if (!stream->on_frame)
+    {
+        stream->on_data(buf->peek(), buf->readable_bytes());
+        buf->retrieve_all();
+        return;
+    }
+
+    /**
+     * each frame is handed over while it's still in the buffer,
+     *  so the data is written out without being copied
+    */
+    while (!stream->closed)
+    {
+        bool malformed = false;
+        auto view = MessageView::parse(buf, malformed);
+        if (!view.has_value() && !malformed)
+        {
+            return;
+        }
+
+        auto keep = !malformed && stream->on_frame(view.value());
+        if (!keep)
+        {
+            buf->retrieve_all();
+            stream->conn->force_close();
+            close_stream(stream);
+            return;
+        }
+        buf->retrieve(view->frame_size());
+    }
+}
+
+void ConnectionPool::close_stream(const StreamPtr &stream)
+{
+    if (stream->closed)
+    {
+        return;
+    }
+    stream->closed = true;
+    streams_.erase(stream->id);
+    if (stream->idle_timer.has_value())
+    {
+        loop_->cancel(stream->idle_timer.value());
+        stream->idle_timer.reset();
+    }
+
+    loop_->queue_in_loop([stream] {});
+    stream->on_close();
+}
+} // namespace chord
@@ -0,0 +1,152 @@
+#ifndef __CHORD_CONNECTIONPOOL_HPP__
+#define __CHORD_CONNECTIONPOOL_HPP__
+
+#include "message.hpp"
+
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <functional>
+#include <icarus/timerid.hpp>
+#include <icarus/callbacks.hpp>
+#include <icarus/eventloop.hpp>
+#include <icarus/tcpclient.hpp>
+#include <icarus/inetaddress.hpp>
+
+namespace chord
+{
+/**
+ * keep-alive connections to peers, keyed by `ip:port`
+ *  all of them are driven by the given event loop
+ *
+ * a connection carries at most one request at a time
+ *  so concurrent calls to the same peer open more connections,
+ *  and idle ones are kept for reuse until they are evicted
+*/
+class ConnectionPool
+{
+  public:
+    using ResponseCallback = std::function<void(const std::optional<Message> &result)>;
+    using DataCallback = std::function<void(const char *data, std::size_t len)>;
+    /**
+     * return false to stop receiving and close the stream
+    */
+    using FrameCallback = std::function<bool(const MessageView &frame)>;
+    using CloseCallback = std::function<void()>;
+    using StreamId = std::uint64_t;
+
+  public:
+    explicit ConnectionPool(icarus::EventLoop *loop);
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool &) = delete;
+    ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+    /**
+     * the following methods are thread safe
+     *  and callbacks are always called in the loop
+    */
+    void post(const icarus::InetAddress &addr, const Message &msg);
+    /**
+     * zero timeout means waiting until the peer answers or disconnects,
+     *  otherwise the callback gets nothing once it's passed
+     *  which is checked by a timer of the loop, to the millisecond
+    */
+    void call(const icarus::InetAddress &addr, const Message &msg,
+        std::chrono::milliseconds timeout, ResponseCallback callback);
+    /**
+     * streams are not pooled,
+     *  the connection is closed by the peer after sending all data,
+     *  or by the pool once nothing comes from it for a while
+    */
+    void stream(const icarus::InetAddress &addr, const Message &msg,
+        DataCallback on_data, CloseCallback on_close);
+    /**
+     * same as stream but the request and the data go in binary frames,
+     *  and the callback decides when the transfer is complete
+    */
+    StreamId fetch(const icarus::InetAddress &addr, const Message &msg,
+        FrameCallback on_frame, CloseCallback on_close);
+    /**
+     * close the stream, its close callback is called if it's not over yet
+    */
+    void cancel(StreamId id);
+
+    void set_idle_timeout(std::chrono::seconds time);
+    void set_max_idle_per_peer(std::size_t num);
+
+    icarus::EventLoop *loop() const;
+
+  private:
+    struct Request
+    {
+        Message msg;
+        bool expect_response;
+        /**
+         * time_point::max() if there's no timeout,
+         *  it's kept when the request is resent
+        */
+        std::chrono::steady_clock::time_point deadline;
+        ResponseCallback callback;
+        /**
+         * a request which fails on a reused connection is resent once
+         *  because the peer may have closed it while it was idle
+        */
+        bool retried;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    struct Channel;
+    using ChannelPtr = std::shared_ptr<Channel>;
+    using ChannelWeakPtr = std::weak_ptr<Channel>;
+
+    struct Stream;
+    using StreamPtr = std::shared_ptr<Stream>;
+
+    void dispatch(const icarus::InetAddress &addr, Request req);
+    void start_request(const ChannelPtr &channel);
+    void finish_request(const ChannelPtr &channel, const std::optional<Message> &result);
+    void cancel_deadline(const ChannelPtr &channel);
+
+    ChannelPtr acquire(const icarus::InetAddress &addr);
+    ChannelPtr connect(const icarus::InetAddress &addr);
+    void release(const ChannelPtr &channel);
+    void close(const ChannelPtr &channel);
+    void abort(const ChannelPtr &channel);
+    void proceed(const ChannelPtr &channel);
+
+    void say_hello(const ChannelPtr &channel);
+    void on_hello(const ChannelPtr &channel, const std::optional<Message> &result);
+
+    void on_connection(const ChannelWeakPtr &weak, const icarus::TcpConnectionPtr &conn);
+    void on_message(const ChannelWeakPtr &weak, icarus::Buffer *buf);
+    void evict_idle();
+
+    void open_stream(const StreamPtr &stream, const std::string &request);
+    void watch_stream(const StreamPtr &stream);
+    void on_stream_message(const StreamPtr &stream, icarus::Buffer *buf);
+    void close_stream(const StreamPtr &stream);
+
+  private:
+    icarus::EventLoop *loop_;
+    icarus::TimerId evict_timer_;
+
+    std::chrono::seconds idle_timeout_;
+    std::size_t max_idle_per_peer_;
+
+    std::uint64_t next_request_id_;
+    std::map<std::string, std::vector<ChannelPtr>> peers_;
+    /**
+     * whether the peer speaks binary frames, learned by Hello
+    */
+    std::map<std::string, bool> binary_peers_;
+    std::atomic<StreamId> next_stream_id_;
+    std::map<StreamId, StreamPtr> streams_;
+};
+} // namespace chord
+
+#endif
@@ -0,0 +1,211 @@
+#include "message.hpp"
+#include "metrics.hpp"
+#include "filesender.hpp"
+#include "ratelimiter.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <icarus/eventloop.hpp>
+#include <icarus/tcpconnection.hpp>
+
+namespace chord
+{
+std::shared_ptr<FileSender> FileSender::open(const std::string &path)
+{
+    return open(path, 0, UINT64_MAX);
+}
+
+std::shared_ptr<FileSender> FileSender::open(const std::string &path,
+    std::uint64_t offset, std::uint64_t size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)
+        || static_cast<std::uint64_t>(st.st_size) < offset)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+    auto file_size = static_cast<std::uint64_t>(st.st_size);
+    size = std::min(size, file_size - offset);
+
+    /**
+     * an empty range cannot be mapped
+    */
+    static const auto page = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+    auto base = offset / page * page;
+    auto map_size = static_cast<std::size_t>(offset - base + size);
+    char *map = nullptr;
+    if (size > 0)
+    {
+        auto addr = ::mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, base);
+        if (addr == MAP_FAILED)
+        {
+            ::close(fd);
+            return nullptr;
+        }
+        ::madvise(addr, map_size, MADV_SEQUENTIAL);
+        map = static_cast<char *>(addr);
+    }
+
+    return std::make_shared<FileSender>(fd, map, map_size,
+        map + (offset - base), static_cast<std::size_t>(size));
+}
+
+void FileSender::not_found(const icarus::TcpConnectionPtr &conn)
+{
+    conn->send(Message(Message::DataEnd, 0, false).to_frame());
+    conn->shutdown();
+}
+
+FileSender::FileSender(int fd, char *map, std::size_t map_size, const char *data, std::size_t size)
+  : fd_(fd)
+  , map_(map)
+  , map_size_(map_size)
+  , data_(data)
+  , size_(size)
+  , object_size_(size)
+  , version_(0)
+  , checksum_(0)
+  , offset_(0)
+  , released_(0)
+  , framed_(false)
+  , limiter_(nullptr)
+{
+    // ...
+}
+
+FileSender::~FileSender()
+{
+    if (map_ != nullptr)
+    {
+        ::munmap(map_, map_size_);
+    }
+    ::close(fd_);
+}
+
+void FileSender::start(const icarus::TcpConnectionPtr &conn, bool framed)
+{
+    framed_ = framed;
+    conn->set_write_complete_callback([self = shared_from_this()] (const icarus::TcpConnectionPtr &conn)
+    {
+        self->send_chunks(conn);
+    });
+    send_chunks(conn);
+}
+
+std::size_t FileSender::size() const
+{
+    return size_;
+}
+
+void FileSender::set_object_size(std::uint64_t size)
+{
+    object_size_ = size;
+}
+
+void FileSender::set_version(std::uint64_t version, std::uint32_t checksum)
+{
+    version_ = version;
+    checksum_ = checksum;
+}
+
+void FileSender::set_rate_limiter(RateLimiter *limiter)
+{
+    limiter_ = limiter;
+}
+
+/**
+ * the write complete callback comes only when the output buffer is drained,
+ *  refill it up to the high water mark then wait for the next one
+*/
+void FileSender::send_chunks(const icarus::TcpConnectionPtr &conn)
+{
+    if (offset_ == size_)
+    {
+        finish(conn);
+        return;
+    }
+
+    auto end = std::min(size_, offset_ + kHighWaterMark);
+    if (limiter_ == nullptr)
+    {
+        send_until(conn, end);
+        return;
+    }
+
+    /**
+     * the refill is charged at once and put off until it's due,
+     *  the write complete callback comes again after it's sent
+    */
+    auto delay = limiter_->charge(end - offset_) - std::chrono::steady_clock::now();
+    if (delay <= std::chrono::steady_clock::duration::zero())
+    {
+        send_until(conn, end);
+        return;
+    }
+    conn->get_loop()->run_after(std::chrono::duration<double>(delay).count(),
+        [self = shared_from_this(), conn, end]
+        {
+            self->send_until(conn, end);
+        }
+    );
+}
+
+void FileSender::send_until(const icarus::TcpConnectionPtr &conn, std::size_t end)
+{
+    while (offset_ < end)
+    {
+        send_chunk(conn);
+    }
+}
+
+void FileSender::send_chunk(const icarus::TcpConnectionPtr &conn)
+{
+    auto len = std::min(kChunkSize, size_ - offset_);
+    if (framed_)
+    {
+        conn->send(Message(Message::Data, data_ + offset_, len).to_frame());
+    }
+    else
+    {
+        conn->send(std::string(data_ + offset_, len));
+    }
+    offset_ += len;
+    Metrics::instance().sent_bytes.add(len);
+
+    /**
+     * the sent pages won't be read again,
+     *  drop them from this process to keep its rss flat,
+     *  counted from map_ as madvise only takes page boundaries
+    */
+    static const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    auto done = static_cast<std::size_t>(data_ - map_ + offset_) / page * page;
+    if (done > released_ && ::madvise(map_ + released_, done - released_, MADV_DONTNEED) == 0)
+    {
+        released_ = done;
+    }
+}
+
+void FileSender::finish(const icarus::TcpConnectionPtr &conn)
+{
+    /**
+     * break the cycle between the connection and this sender
+    */
+    conn->set_write_complete_callback(icarus::WriteCompleteCallback());
+    if (framed_)
+    {
+        conn->send(Message(Message::DataEnd, size_, true)
+            .add_number(object_size_).add_number(version_).add_number(checksum_).to_frame());
+    }
+    conn->shutdown();
+}
+} // namespace chord
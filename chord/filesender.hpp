@@ -0,0 +1,101 @@
+#ifndef __CHORD_FILESENDER_HPP__
+#define __CHORD_FILESENDER_HPP__
+
+#include <memory>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <icarus/callbacks.hpp>
+
+namespace chord
+{
+class RateLimiter;
+/**
+ * serve a file from an mmap region of the page cache in bounded chunks,
+ *  the next chunk is queued only after the previous one is written out,
+ *  so the memory used doesn't grow with the file size
+ *
+ * in framed mode every chunk is a Data frame
+ *  and the transfer is closed by a DataEnd frame with the total size,
+ *  so that the receiver can tell a complete file from a truncated one,
+ *  and the size of the whole object if only a range of it is sent,
+ *  with the version and the checksum of the whole if it's from the store
+*/
+class FileSender : public std::enable_shared_from_this<FileSender>
+{
+  public:
+    static constexpr std::size_t kChunkSize = 64 * 1024;
+    /**
+     * the most bytes queued in the output buffer at once
+    */
+    static constexpr std::size_t kHighWaterMark = 4 * kChunkSize;
+
+    /**
+     * return nullptr if the file cannot be opened
+    */
+    static std::shared_ptr<FileSender> open(const std::string &path);
+    /**
+     * send only size bytes from offset of the file
+    */
+    static std::shared_ptr<FileSender> open(const std::string &path,
+        std::uint64_t offset, std::uint64_t size);
+
+    /**
+     * send a DataEnd frame which says the file is not found
+    */
+    static void not_found(const icarus::TcpConnectionPtr &conn);
+
+    FileSender(int fd, char *map, std::size_t map_size, const char *data, std::size_t size);
+    ~FileSender();
+
+    FileSender(const FileSender &) = delete;
+    FileSender &operator=(const FileSender &) = delete;
+
+    /**
+     * shut down the connection after the whole file is sent
+    */
+    void start(const icarus::TcpConnectionPtr &conn, bool framed = false);
+    std::size_t size() const;
+    /**
+     * the size sent by default
+    */
+    void set_object_size(std::uint64_t size);
+    /**
+     * of the object in the store, 0 for none by default
+    */
+    void set_version(std::uint64_t version, std::uint32_t checksum);
+    /**
+     * pace the chunks by the limiter, which must outlive the transfer
+    */
+    void set_rate_limiter(RateLimiter *limiter);
+
+  private:
+    void send_chunks(const icarus::TcpConnectionPtr &conn);
+    void send_until(const icarus::TcpConnectionPtr &conn, std::size_t end);
+    void send_chunk(const icarus::TcpConnectionPtr &conn);
+    void finish(const icarus::TcpConnectionPtr &conn);
+
+  private:
+    int fd_;
+    /**
+     * the mapping starts at a page boundary
+     *  and data_ is somewhere in it
+    */
+    char *map_;
+    std::size_t map_size_;
+    const char *data_;
+    std::size_t size_;
+    std::uint64_t object_size_;
+    std::uint64_t version_;
+    std::uint32_t checksum_;
+    std::size_t offset_;
+    /**
+     * the bytes from map_ dropped already
+    */
+    std::size_t released_;
+    bool framed_;
+    RateLimiter *limiter_;
+};
+} // namespace chord
+
+#endif
@@ -3,14 +3,14 @@
 
 #include <cassert>
 #include <iostream>
+#include <algorithm>
 
 namespace chord
 {
 FingerTable::FingerTable(const icarus::InetAddress &addr)
   : self_(addr)
-  , nodes_(M, Node(addr))
 {
-    // ...
+    fingers_.fill(self_.hash().value());
 }
 
 const Node &FingerTable::find_closest_pre(const Node &node) const
@@ -18,38 +18,43 @@ const Node &FingerTable::find_closest_pre(const Node &node) const
     return find_closest_pre(node.hash());
 }
 
+/**
+ * the node at or before the hash on the ring,
+ *  i.e. the last one not greater than the hash
+ *  or the greatest one if the hash is less than all
+*/
 const Node &FingerTable::find_closest_pre(const HashType &hash) const
 {
-    constexpr std::size_t max = -1;
+    if (hashes_.empty())
+    {
+        return self_;
+    }
 
-    std::size_t ind = 0;
-    HashType dis = max;
-    for (std::size_t i = 0; i < M; ++i)
+    auto it = std::upper_bound(hashes_.begin(), hashes_.end(), hash.value());
+    if (it == hashes_.begin())
     {
-        auto now = nodes_[i].hash();
-        if (now <= hash)
-        {
-            if (hash - now < dis)
-            {
-                dis = hash - now;
-                ind = i;
-            }
-        }
-        else if (hash < now)
-        {
-            if (hash + max - now < dis)
-            {
-                dis = hash + max - now;
-                ind = i;
-            }
-        }
+        return nodes_.back();
     }
+    return nodes_[it - hashes_.begin() - 1];
+}
 
-    if (dis == max)
+std::vector<Node> FingerTable::find_closest_pres(const HashType &hash, std::size_t num) const
+{
+    std::vector<Node> result;
+    if (hashes_.empty())
     {
-        return self_;
+        return result;
     }
-    return nodes_[ind];
+
+    auto size = hashes_.size();
+    std::size_t ind = std::upper_bound(hashes_.begin(), hashes_.end(), hash.value()) - hashes_.begin();
+    for (std::size_t i = 0; i < std::min(num, size); ++i)
+    {
+        ind = (ind + size - 1) % size;
+        result.push_back(nodes_[ind]);
+    }
+
+    return result;
 }
 
 const Node &FingerTable::find_closest_suc(const Node &node) const
@@ -57,38 +62,20 @@ const Node &FingerTable::find_closest_suc(const Node &node) const
     return find_closest_suc(node.hash());
 }
 
+/**
+ * different from find_closest_pre
+ *  don't consider the same case
+*/
 const Node &FingerTable::find_closest_suc(const HashType &hash) const
 {
-    constexpr std::size_t max = -1;
-
-    std::size_t ind = 0;
-    HashType dis = max;
-    for (std::size_t i = 0; i < M; ++i)
+    if (hashes_.empty())
     {
-        auto now = nodes_[i].hash();
-        /**
-         * different from find_closest_pre
-         *  don't consider the same case
-        */
-        if (hash < now)
-        {
-            if (now - hash < dis)
-            {
-                dis = now - hash;
-                ind = i;
-            }
-        }
-        else if (now < hash)
-        {
-            if (now + max - hash < dis)
-            {
-                dis = now + max - hash;
-                ind = i;
-            }
-        }
+        return self_;
     }
 
-    if (dis == max)
+    auto it = std::upper_bound(hashes_.begin(), hashes_.end(), hash.value());
+    auto ind = it == hashes_.end() ? 0 : it - hashes_.begin();
+    if (hashes_[ind] == hash.value())
     {
         return self_;
     }
@@ -97,17 +84,32 @@ const Node &FingerTable::find_closest_suc(const HashType &hash) const
 
 void FingerTable::insert(Node node)
 {
+    if (node == self_)
+    {
+        return;
+    }
+
     /**
-     * simply traverse each position in current version
+     * finger i starts at self + 2^i,
+     *  only the ones which start at or before the node may point to it
+     *
+     * a finger other than the successor is kept once it's in its interval,
+     *  it may have been chosen for its rtt, see Proximity
     */
     auto base = self_.hash();
-    for (std::size_t i = 0; i < M; ++i)
+    auto distance = (node.hash() - base).value();
+    for (std::size_t i = 0; i < M && (1ull << i) <= distance; ++i)
     {
+        if (i > 0 && covers(i, (*this)[i]))
+        {
+            continue;
+        }
+
         auto start = base + (1ull << i);
         // statr <= node < nodes[i]
-        if (node.hash() == start || node.between(start, nodes_[i].hash()))
+        if (node.hash() == start || node.between(start, fingers_[i]))
         {
-            nodes_[i] = node;
+            set(i, node);
 
             if (i == 0)
             {
@@ -124,14 +126,21 @@ void FingerTable::remove(Node node)
         return;
     }
 
+    auto value = node.hash().value();
+    auto ind = index_of(value);
+    if (ind == hashes_.size())
+    {
+        return;
+    }
+
     /**
      * simply substitute node by self
     */
     for (std::size_t i = 0; i < M; ++i)
     {
-        if (nodes_[i] == node)
+        if (fingers_[i] == value)
         {
-            nodes_[i] = self_;
+            fingers_[i] = self_.hash().value();
 
             if (i == 0)
             {
@@ -139,6 +148,34 @@ void FingerTable::remove(Node node)
             }
         }
     }
+
+    hashes_.erase(hashes_.begin() + ind);
+    nodes_.erase(nodes_.begin() + ind);
+    refs_.erase(refs_.begin() + ind);
+}
+
+void FingerTable::set(std::size_t ind, Node node)
+{
+    auto old = fingers_[ind];
+    if (old == node.hash().value())
+    {
+        return;
+    }
+
+    acquire(node);
+    fingers_[ind] = node.hash().value();
+    release(old);
+}
+
+bool FingerTable::covers(std::size_t ind, const Node &node) const
+{
+    if (node == self_)
+    {
+        return false;
+    }
+
+    auto distance = (node.hash() - self_.hash()).value();
+    return (distance >> ind) == 1;
 }
 
 const Node &FingerTable::self() const
@@ -151,8 +188,61 @@ const std::vector<Node> &FingerTable::nodes() const
     return nodes_;
 }
 
-Node &FingerTable::operator[](std::size_t ind)
+const Node &FingerTable::operator[](std::size_t ind) const
 {
-    return nodes_[ind];
+    auto value = fingers_[ind];
+    if (value == self_.hash().value())
+    {
+        return self_;
+    }
+    return nodes_[index_of(value)];
+}
+
+std::size_t FingerTable::index_of(std::size_t hash) const
+{
+    auto it = std::lower_bound(hashes_.begin(), hashes_.end(), hash);
+    if (it == hashes_.end() || *it != hash)
+    {
+        return hashes_.size();
+    }
+    return it - hashes_.begin();
+}
+
+void FingerTable::acquire(const Node &node)
+{
+    if (node == self_)
+    {
+        return;
+    }
+
+    auto value = node.hash().value();
+    auto it = std::lower_bound(hashes_.begin(), hashes_.end(), value);
+    auto ind = it - hashes_.begin();
+    if (it != hashes_.end() && *it == value)
+    {
+        ++refs_[ind];
+        return;
+    }
+
+    hashes_.insert(it, value);
+    nodes_.insert(nodes_.begin() + ind, node);
+    refs_.insert(refs_.begin() + ind, 1);
+}
+
+void FingerTable::release(std::size_t hash)
+{
+    if (hash == self_.hash().value())
+    {
+        return;
+    }
+
+    auto ind = index_of(hash);
+    assert(ind != hashes_.size());
+    if (--refs_[ind] == 0)
+    {
+        hashes_.erase(hashes_.begin() + ind);
+        nodes_.erase(nodes_.begin() + ind);
+        refs_.erase(refs_.begin() + ind);
+    }
 }
 } // namespace chord
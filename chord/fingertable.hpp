@@ -3,11 +3,18 @@
 
 #include "node.hpp"
 
+#include <array>
 #include <vector>
+#include <cstdint>
 
 namespace chord
 {
 class HashType;
+/**
+ * fingers are kept as raw hash values,
+ *  and the distinct nodes they point to are kept apart,
+ *  sorted by hash, so that the closest ones are found by binary search
+*/
 class FingerTable
 {
   public:
@@ -22,6 +29,11 @@ class FingerTable
     */
     const Node &find_closest_pre(const Node &node) const;
     const Node &find_closest_pre(const HashType &hash) const;
+    /**
+     * return at most num distinct nodes other than self
+     *  which precede the given hash, the closest first
+    */
+    std::vector<Node> find_closest_pres(const HashType &hash, std::size_t num) const;
     const Node &find_closest_suc(const Node &node) const;
     const Node &find_closest_suc(const HashType &hash) const;
     /**
@@ -30,14 +42,41 @@ class FingerTable
     */
     void insert(Node node);
     void remove(Node node);
+    void set(std::size_t ind, Node node);
+
+    /**
+     * whether the node is in [self + 2^i, self + 2^(i+1)),
+     *  any such node may be finger i
+    */
+    bool covers(std::size_t ind, const Node &node) const;
 
     const Node &self() const;
+    /**
+     * the distinct nodes other than self, sorted by hash
+    */
     const std::vector<Node> &nodes() const;
-    Node &operator[](std::size_t ind);
+    const Node &operator[](std::size_t ind) const;
+
+  private:
+    /**
+     * index of the given hash in hashes_
+     *  or the size of hashes_ if it's not in the table
+    */
+    std::size_t index_of(std::size_t hash) const;
+    void acquire(const Node &node);
+    void release(std::size_t hash);
 
   private:
     Node self_;
+    std::array<std::size_t, M> fingers_;
+
+    /**
+     * distinct nodes except self, sorted by hash
+     *  hashes_, nodes_ and refs_ are parallel
+    */
+    std::vector<std::size_t> hashes_;
     std::vector<Node> nodes_;
+    std::vector<std::uint32_t> refs_;
 };
 } // namespace chord
 
@@ -0,0 +1,258 @@
+#include "hasher.hpp"
+
+#include <atomic>
+#include <cstring>
+
+namespace chord
+{
+namespace
+{
+std::atomic<Hasher::Algorithm> g_algorithm(Hasher::XXH64);
+
+constexpr std::uint64_t kPrime1 = 11400714785074694791ull;
+constexpr std::uint64_t kPrime2 = 14029467366897019727ull;
+constexpr std::uint64_t kPrime3 = 1609587929392839161ull;
+constexpr std::uint64_t kPrime4 = 9650029242287828579ull;
+constexpr std::uint64_t kPrime5 = 2870177450012600261ull;
+
+inline std::uint64_t rotl(std::uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline std::uint32_t rotl32(std::uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+/**
+ * xxh64 reads little endian words
+*/
+inline std::uint64_t read64(const char *p)
+{
+    std::uint64_t value;
+    std::memcpy(&value, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+inline std::uint32_t read32(const char *p)
+{
+    std::uint32_t value;
+    std::memcpy(&value, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+inline std::uint64_t round(std::uint64_t acc, std::uint64_t input)
+{
+    acc += input * kPrime2;
+    acc = rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+inline std::uint64_t merge_round(std::uint64_t acc, std::uint64_t value)
+{
+    acc ^= round(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+} // namespace
+
+void Hasher::set_algorithm(Algorithm algorithm)
+{
+    g_algorithm = algorithm;
+}
+
+Hasher::Algorithm Hasher::algorithm()
+{
+    return g_algorithm;
+}
+
+bool Hasher::set_algorithm(std::string_view name)
+{
+    if (name == "xxh64")
+    {
+        set_algorithm(XXH64);
+    }
+    else if (name == "sha1")
+    {
+        set_algorithm(SHA1);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+std::string_view Hasher::name(Algorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case XXH64:
+        return "xxh64";
+    case SHA1:
+        return "sha1";
+    }
+    return "unknown";
+}
+
+std::uint64_t Hasher::hash(std::string_view data)
+{
+    return algorithm() == SHA1 ? sha1(data) : xxh64(data);
+}
+
+std::uint64_t Hasher::xxh64(std::string_view data, std::uint64_t seed)
+{
+    auto p = data.data();
+    auto end = p + data.size();
+    std::uint64_t h;
+
+    if (data.size() >= 32)
+    {
+        auto limit = end - 32;
+        std::uint64_t v1 = seed + kPrime1 + kPrime2;
+        std::uint64_t v2 = seed + kPrime2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - kPrime1;
+        do
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + kPrime5;
+    }
+
+    h += data.size();
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= static_cast<std::uint64_t>(read32(p)) * kPrime1;
+        h = rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= static_cast<unsigned char>(*p) * kPrime5;
+        h = rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+/**
+ * the first 64 bits of the digest in big endian
+*/
+std::uint64_t Hasher::sha1(std::string_view data)
+{
+    std::uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+    auto process = [&h] (const unsigned char *block)
+    {
+        std::uint32_t w[80];
+        for (int i = 0; i < 16; ++i)
+        {
+            w[i] = (std::uint32_t(block[i * 4]) << 24) | (std::uint32_t(block[i * 4 + 1]) << 16)
+                | (std::uint32_t(block[i * 4 + 2]) << 8) | std::uint32_t(block[i * 4 + 3]);
+        }
+        for (int i = 16; i < 80; ++i)
+        {
+            w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        auto a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i)
+        {
+            std::uint32_t f, k;
+            if (i < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+
+            auto temp = rotl32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl32(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    };
+
+    auto p = reinterpret_cast<const unsigned char *>(data.data());
+    auto len = data.size();
+    std::size_t pos = 0;
+    for (; pos + 64 <= len; pos += 64)
+    {
+        process(p + pos);
+    }
+
+    /**
+     * the padding: 0x80, zeros, then the bit length in 64-bit big endian
+    */
+    unsigned char tail[128] = {};
+    auto rest = len - pos;
+    std::memcpy(tail, p + pos, rest);
+    tail[rest] = 0x80;
+    std::size_t tail_len = rest + 1 + 8 <= 64 ? 64 : 128;
+    std::uint64_t bits = static_cast<std::uint64_t>(len) * 8;
+    for (int i = 0; i < 8; ++i)
+    {
+        tail[tail_len - 1 - i] = static_cast<unsigned char>(bits >> (i * 8));
+    }
+    process(tail);
+    if (tail_len == 128)
+    {
+        process(tail + 64);
+    }
+
+    return (static_cast<std::uint64_t>(h[0]) << 32) | h[1];
+}
+} // namespace chord
@@ -0,0 +1,44 @@
+#ifndef __CHORD_HASHER_HPP__
+#define __CHORD_HASHER_HPP__
+
+#include <cstdint>
+#include <string_view>
+
+namespace chord
+{
+/**
+ * the hash of node ids and keys, fixed by its algorithm
+ *  so that nodes built by different compilers agree on the ring
+ *
+ * xxh64 is the default, sha-1 as in the paper is optional,
+ *  whose first 64 bits are taken as the id
+ *
+ * the algorithm must be chosen before any id is calculated
+ *  and be the same on all the nodes of a ring,
+ *  which is told in Hello and checked on join
+*/
+class Hasher
+{
+  public:
+    enum Algorithm
+    {
+        XXH64,
+        SHA1,
+    };
+
+    static void set_algorithm(Algorithm algorithm);
+    static Algorithm algorithm();
+    /**
+     * return false if the name is unknown
+    */
+    static bool set_algorithm(std::string_view name);
+    static std::string_view name(Algorithm algorithm);
+
+    static std::uint64_t hash(std::string_view data);
+
+    static std::uint64_t xxh64(std::string_view data, std::uint64_t seed = 0);
+    static std::uint64_t sha1(std::string_view data);
+};
+} // namespace chord
+
+#endif
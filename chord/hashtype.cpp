@@ -1,9 +1,13 @@
+#include "hasher.hpp"
 #include "hashtype.hpp"
 
-#include <functional>
-
 namespace chord
 {
+HashType HashType::of(std::string_view data)
+{
+    return HashType(Hasher::hash(data));
+}
+
 HashType::HashType(std::size_t value)
   : value_(value)
 {
@@ -11,7 +15,7 @@ HashType::HashType(std::size_t value)
 }
 
 HashType::HashType(const icarus::InetAddress &addr)
-  : HashType(std::hash<std::string>{}(addr.to_ip_port()))
+  : HashType(of(addr.to_ip_port()))
 {
     // ...
 }
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <cstddef>
+#include <string_view>
 #include <icarus/inetaddress.hpp>
 
 namespace chord
@@ -12,6 +13,12 @@ namespace chord
 */
 class HashType
 {
+  public:
+    /**
+     * the id of a key, see Hasher
+    */
+    static HashType of(std::string_view data);
+
   public:
     HashType(std::size_t value);
     HashType(const icarus::InetAddress &addr);
@@ -32,8 +39,7 @@ class HashType
 
   private:
     /**
-     * hash_value is calculated by the standard function hash simply
-     *  instead of using sha-1 or sha-256
+     * hash_value is calculated by Hasher,
      *  and assume that its size is 64-bits
     */
     std::size_t value_;
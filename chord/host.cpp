@@ -0,0 +1,223 @@
+#include "host.hpp"
+#include "instruction.hpp"
+
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+namespace chord
+{
+Host::Host(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr, std::size_t weight)
+  : loop_(loop)
+  , listen_addr_(listen_addr)
+  , pool_(loop)
+  , store_("data-" + std::to_string(listen_addr.to_port()))
+  , lookup_mode_(Server::Recursive)
+  , successor_list_size_(SuccessorList::kDefaultSize)
+  , lookup_timeout_(Server::kLookupTimeout)
+  , probe_timeout_(Server::kProbeTimeout)
+  , started_(false)
+  , weight_(std::max<std::size_t>(weight, 1))
+{
+    for (std::size_t i = 0; i < Server::kRoutines; ++i)
+    {
+        periods_[i] = Server::default_period(static_cast<Server::Routine>(i));
+    }
+
+    for (std::size_t i = 0; i < weight_; ++i)
+    {
+        add_node();
+    }
+}
+
+void Host::start()
+{
+    started_ = true;
+    for (auto &node : nodes_)
+    {
+        node->start();
+    }
+}
+
+void Host::set_lookup_mode(Server::LookupMode mode)
+{
+    lookup_mode_ = mode;
+    for (auto &node : nodes_)
+    {
+        node->set_lookup_mode(mode);
+    }
+}
+
+void Host::set_successor_list_size(std::size_t size)
+{
+    successor_list_size_ = size;
+    for (auto &node : nodes_)
+    {
+        node->set_successor_list_size(size);
+    }
+}
+
+void Host::set_period(Server::Routine routine, Server::Period period)
+{
+    periods_[routine] = period;
+    for (auto &node : nodes_)
+    {
+        node->set_period(routine, period);
+    }
+}
+
+void Host::set_lookup_timeout(std::chrono::milliseconds time)
+{
+    lookup_timeout_ = time;
+    for (auto &node : nodes_)
+    {
+        node->set_lookup_timeout(time);
+    }
+}
+
+void Host::set_probe_timeout(std::chrono::milliseconds time)
+{
+    probe_timeout_ = time;
+    for (auto &node : nodes_)
+    {
+        node->set_probe_timeout(time);
+    }
+}
+
+/**
+ * the first virtual node takes the instructions for the ring,
+ *  and the others follow it into the ring
+*/
+void Host::handle_instruction(const Instruction &ins)
+{
+    switch (ins.type())
+    {
+    case Instruction::Join:
+    case Instruction::SelfBoot:
+        first().handle_instruction(ins);
+        for (std::size_t i = 1; i < weight_ && first().established(); ++i)
+        {
+            nodes_[i]->join(first().listen_addr());
+        }
+        break;
+
+    case Instruction::Get:
+    case Instruction::Put:
+    case Instruction::MGet:
+    case Instruction::MPut:
+    case Instruction::Stats:
+        first().handle_instruction(ins);
+        break;
+
+    case Instruction::Quit:
+        for (std::size_t i = weight_; i > 0; --i)
+        {
+            nodes_[i - 1]->stop();
+        }
+
+        /**
+         * the quit messages are sent by the pool in the loop,
+         *  give them a moment before the loop stops
+        */
+        loop_->run_after(1, [loop = loop_]
+        {
+            loop->quit();
+        });
+        break;
+
+    case Instruction::Print:
+        for (std::size_t i = 0; i < weight_; ++i)
+        {
+            nodes_[i]->handle_instruction(ins);
+        }
+        break;
+
+    case Instruction::Weight:
+        set_weight(std::stoul(ins.value()));
+        std::cout << "[WEIGHT] Is " << weight_ << std::endl;
+        break;
+    }
+}
+
+void Host::set_weight(std::size_t weight)
+{
+    weight = std::max<std::size_t>(weight, 1);
+
+    while (weight_ < weight)
+    {
+        if (weight_ == nodes_.size())
+        {
+            add_node();
+        }
+
+        auto &node = *nodes_[weight_++];
+        if (first().established())
+        {
+            node.join(first().listen_addr());
+        }
+    }
+
+    while (weight_ > weight)
+    {
+        nodes_[--weight_]->stop();
+    }
+}
+
+std::size_t Host::weight() const
+{
+    return weight_;
+}
+
+Server &Host::node(std::size_t ind)
+{
+    return *nodes_[ind];
+}
+
+Server &Host::first()
+{
+    return *nodes_.front();
+}
+
+Server &Host::add_node()
+{
+    auto port = static_cast<std::uint16_t>(listen_addr_.to_port() + nodes_.size());
+    icarus::InetAddress addr(listen_addr_.to_ip().c_str(), port);
+
+    auto node = std::make_unique<Server>(loop_, addr, pool_, store_);
+    node->set_thread_num(nodes_.empty() ? 10 : kThreadsPerNode);
+    node->set_lookup_mode(lookup_mode_);
+    node->set_successor_list_size(successor_list_size_);
+    node->set_lookup_timeout(lookup_timeout_);
+    node->set_probe_timeout(probe_timeout_);
+    for (std::size_t i = 0; i < Server::kRoutines; ++i)
+    {
+        node->set_period(static_cast<Server::Routine>(i), periods_[i]);
+    }
+    node->set_local_check([this] (const icarus::InetAddress &addr)
+    {
+        return is_local(addr);
+    });
+    if (started_)
+    {
+        node->start();
+    }
+
+    std::lock_guard lock(mutex_);
+    hashes_.push_back(HashType(addr));
+    nodes_.push_back(std::move(node));
+    return *nodes_.back();
+}
+
+/**
+ * only the nodes in the ring, a removed one is kept idle
+ *  and its keys have been handed over to the real owner
+*/
+bool Host::is_local(const icarus::InetAddress &addr) const
+{
+    HashType hash(addr);
+
+    std::lock_guard lock(mutex_);
+    auto it = std::find(hashes_.begin(), hashes_.end(), hash);
+    return it != hashes_.end() && nodes_[it - hashes_.begin()]->established();
+}
+} // namespace chord
@@ -0,0 +1,88 @@
+#ifndef __CHORD_HOST_HPP__
+#define __CHORD_HOST_HPP__
+
+#include "store.hpp"
+#include "server.hpp"
+#include "connectionpool.hpp"
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <icarus/eventloop.hpp>
+#include <icarus/inetaddress.hpp>
+
+namespace chord
+{
+class Instruction;
+/**
+ * a physical server which hosts some virtual nodes,
+ *  the i-th one is a Server listening at listen_port + i
+ *  with a finger table and a predecessor of its own,
+ *  and all of them share the loop, the connection pool and the store
+ *
+ * the weight is the number of the virtual nodes in the ring,
+ *  a bigger box takes a bigger share of the keys by a bigger weight
+*/
+class Host
+{
+  public:
+    static constexpr int kThreadsPerNode = 2;
+
+  public:
+    Host(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr, std::size_t weight = 1);
+
+    void start();
+
+    void set_lookup_mode(Server::LookupMode mode);
+    void set_successor_list_size(std::size_t size);
+    void set_period(Server::Routine routine, Server::Period period);
+    void set_lookup_timeout(std::chrono::milliseconds time);
+    void set_probe_timeout(std::chrono::milliseconds time);
+
+    void handle_instruction(const Instruction &ins);
+
+    /**
+     * the added virtual nodes join the ring by the first one,
+     *  the removed ones hand their keys over and quit,
+     *  they are kept idle to be reused
+     *
+     * it blocks, so it must not be called in the loop
+    */
+    void set_weight(std::size_t weight);
+    std::size_t weight() const;
+    Server &node(std::size_t ind);
+
+  private:
+    /**
+     * the one which takes the instructions
+    */
+    Server &first();
+    Server &add_node();
+    bool is_local(const icarus::InetAddress &addr) const;
+
+  private:
+    icarus::EventLoop *loop_;
+    icarus::InetAddress listen_addr_;
+    ConnectionPool pool_;
+    Store store_;
+
+    Server::LookupMode lookup_mode_;
+    std::size_t successor_list_size_;
+    std::array<Server::Period, Server::kRoutines> periods_;
+    std::chrono::milliseconds lookup_timeout_;
+    std::chrono::milliseconds probe_timeout_;
+    bool started_;
+
+    /**
+     * the first weight_ of nodes_ are in the ring
+    */
+    std::size_t weight_;
+    std::vector<std::unique_ptr<Server>> nodes_;
+    std::vector<HashType> hashes_;
+    mutable std::mutex mutex_;
+};
+} // namespace chord
+
+#endif
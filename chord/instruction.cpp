@@ -1,3 +1,4 @@
+#include "message.hpp"
 #include "instruction.hpp"
 
 namespace chord
@@ -17,13 +18,16 @@ std::optional<Instruction> Instruction::parse(const std::string &ins)
          * TODO: catch join-ins with wrong value
         */
     }
-    else if (type_str == "get")
+    else if (type_str == "get" || type_str == "put")
     {
-        type = Get;
-    }
-    else if (type_str == "put")
-    {
-        type = Put;
+        type = type_str == "get" ? Get : Put;
+        /**
+         * the file name is sent as one string param
+        */
+        if (value.size() > Message::kMaxString)
+        {
+            return {};
+        }
     }
     else if (type_str == "quit")
     {
@@ -37,6 +41,22 @@ std::optional<Instruction> Instruction::parse(const std::string &ins)
     {
         type = Print;
     }
+    else if (type_str == "weight")
+    {
+        type = Weight;
+    }
+    else if (type_str == "stats")
+    {
+        type = Stats;
+    }
+    else if (type_str == "mget")
+    {
+        type = MGet;
+    }
+    else if (type_str == "mput")
+    {
+        type = MPut;
+    }
     else
     {
         return {};
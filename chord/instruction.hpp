@@ -18,6 +18,11 @@ class Instruction
         Quit, // quit
         SelfBoot, // self-boot
         Print, // print
+        Weight, // weight num_of_virtual_nodes
+        Stats, // stats
+
+        MGet, // mget [-j concurrency] filename_or_dir...
+        MPut, // mput [-j concurrency] filepath_or_dir...
     };
 
     static std::optional<Instruction>
@@ -0,0 +1,129 @@
+#include "client.hpp"
+#include "lookup.hpp"
+#include "fingertable.hpp"
+#include "connectionpool.hpp"
+
+#include <algorithm>
+
+namespace chord
+{
+namespace
+{
+/**
+ * bound the walk in case of a broken ring
+*/
+constexpr std::size_t kMaxProbes = 2 * FingerTable::M;
+} // namespace
+
+void Lookup::start(ConnectionPool &pool, const HashType &hash,
+    std::vector<Node> candidates, std::size_t alpha,
+    std::chrono::milliseconds hop_timeout,
+    Callback callback, DeadCallback on_dead)
+{
+    auto lookup = std::make_shared<Lookup>(pool, hash, alpha, hop_timeout,
+        std::move(callback), std::move(on_dead));
+    for (auto &node : candidates)
+    {
+        lookup->add_candidate(node);
+    }
+
+    /**
+     * all the state of a lookup is touched only in the loop of the pool
+    */
+    pool.loop()->run_in_loop([lookup]
+    {
+        lookup->probe();
+    });
+}
+
+Lookup::Lookup(ConnectionPool &pool, const HashType &hash,
+    std::size_t alpha, std::chrono::milliseconds hop_timeout,
+    Callback callback, DeadCallback on_dead)
+  : pool_(pool)
+  , hash_(hash)
+  , alpha_(std::max<std::size_t>(alpha, 1))
+  , hop_timeout_(hop_timeout)
+  , callback_(std::move(callback))
+  , on_dead_(std::move(on_dead))
+  , finished_(false)
+  , in_flight_(0)
+  , probes_(0)
+{
+    // ...
+}
+
+void Lookup::add_candidate(const Node &node)
+{
+    if (std::find(asked_.begin(), asked_.end(), node.hash()) != asked_.end()
+        || std::find(candidates_.begin(), candidates_.end(), node) != candidates_.end())
+    {
+        return;
+    }
+
+    auto distance = (hash_ - node.hash()).value();
+    auto pos = std::find_if(candidates_.begin(), candidates_.end(), [this, distance] (const Node &other)
+    {
+        return distance < (hash_ - other.hash()).value();
+    });
+    candidates_.insert(pos, node);
+}
+
+/**
+ * keep alpha probes in flight to the closest unasked candidates
+*/
+void Lookup::probe()
+{
+    while (!finished_ && in_flight_ < alpha_ && !candidates_.empty() && probes_ < kMaxProbes)
+    {
+        auto node = candidates_.front();
+        candidates_.erase(candidates_.begin());
+        asked_.push_back(node.hash());
+        ++in_flight_;
+        ++probes_;
+
+        Client client(pool_, node.addr(), hop_timeout_);
+        client.send_and_wait_response(Message(
+            Message::ClosestPre, hash_
+        ), [self = shared_from_this(), node] (bool timeout, const std::optional<Message> &result)
+        {
+            self->on_answer(node, timeout, result);
+        });
+    }
+
+    if (!finished_ && in_flight_ == 0)
+    {
+        finish({}, {});
+    }
+}
+
+void Lookup::on_answer(const Node &node, bool timeout, const std::optional<Message> &result)
+{
+    --in_flight_;
+    if (finished_)
+    {
+        return;
+    }
+
+    if (timeout)
+    {
+        on_dead_(node);
+    }
+    else if (result->param_as_flag(2))
+    {
+        finish(Node(result->param_as_addr()), node);
+        return;
+    }
+    else
+    {
+        add_candidate(Node(result->param_as_addr()));
+    }
+
+    probe();
+}
+
+void Lookup::finish(const std::optional<Node> &successor, const std::optional<Node> &via)
+{
+    finished_ = true;
+    callback_(successor, via, probes_);
+}
+} // namespace chord
@@ -0,0 +1,75 @@
+#ifndef __CHORD_LOOKUP_HPP__
+#define __CHORD_LOOKUP_HPP__
+
+#include "node.hpp"
+#include "message.hpp"
+#include "hashtype.hpp"
+
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <functional>
+
+namespace chord
+{
+class ConnectionPool;
+/**
+ * iterative lookup driven by the originator
+ *  each hop is asked for its closest preceding finger of the hash
+ *  by ClosestPre, until one of them answers with the successor
+ *
+ * at most alpha probes are in flight at the same time,
+ *  and a probe which misses its deadline doesn't stall the others
+*/
+class Lookup : public std::enable_shared_from_this<Lookup>
+{
+  public:
+    /**
+     * via is the node which answered the successor,
+     *  probes is the number of nodes asked
+    */
+    using Callback = std::function<void(const std::optional<Node> &successor,
+        const std::optional<Node> &via, std::size_t probes)>;
+    using DeadCallback = std::function<void(const Node &node)>;
+
+    /**
+     * the callback is called exactly once
+     *  with nothing if all the candidates are exhausted
+    */
+    static void start(ConnectionPool &pool, const HashType &hash,
+        std::vector<Node> candidates, std::size_t alpha,
+        std::chrono::milliseconds hop_timeout,
+        Callback callback, DeadCallback on_dead);
+
+    Lookup(ConnectionPool &pool, const HashType &hash,
+        std::size_t alpha, std::chrono::milliseconds hop_timeout,
+        Callback callback, DeadCallback on_dead);
+
+  private:
+    void add_candidate(const Node &node);
+    void probe();
+    void on_answer(const Node &node, bool timeout, const std::optional<Message> &result);
+    void finish(const std::optional<Node> &successor, const std::optional<Node> &via);
+
+  private:
+    ConnectionPool &pool_;
+    HashType hash_;
+    std::size_t alpha_;
+    std::chrono::milliseconds hop_timeout_;
+    Callback callback_;
+    DeadCallback on_dead_;
+
+    bool finished_;
+    std::size_t in_flight_;
+    std::size_t probes_;
+    /**
+     * candidates are sorted by the distance to the hash,
+     *  the closest first
+    */
+    std::vector<Node> candidates_;
+    std::vector<HashType> asked_;
+};
+} // namespace chord
+
+#endif
@@ -0,0 +1,106 @@
+#include "lookupcache.hpp"
+
+namespace chord
+{
+LookupCache::LookupCache(std::size_t capacity)
+  : capacity_(capacity)
+{
+    // ...
+}
+
+std::optional<LookupCache::Route> LookupCache::find(const HashType &hash)
+{
+    std::lock_guard lock(mutex_);
+    if (entries_.empty())
+    {
+        return {};
+    }
+
+    /**
+     * the first arc ending at or after the hash,
+     *  wrapping around the ring
+    */
+    auto it = entries_.lower_bound(hash.value());
+    if (it == entries_.end())
+    {
+        it = entries_.begin();
+    }
+
+    auto &route = it->second.route;
+    if (hash != route.owner.hash() && !hash.between(route.via.hash(), route.owner.hash()))
+    {
+        return {};
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    return route;
+}
+
+void LookupCache::insert(const Node &via, const Node &owner)
+{
+    if (capacity_ == 0 || via == owner)
+    {
+        return;
+    }
+
+    std::lock_guard lock(mutex_);
+    auto it = entries_.find(owner.hash().value());
+    if (it != entries_.end())
+    {
+        erase(it);
+    }
+
+    /**
+     * the arcs ending inside (via, owner)
+    */
+    it = entries_.upper_bound(via.hash().value());
+    while (!entries_.empty())
+    {
+        if (it == entries_.end())
+        {
+            it = entries_.begin();
+        }
+        if (!HashType(it->first).between(via.hash(), owner.hash()))
+        {
+            break;
+        }
+        auto next = std::next(it);
+        erase(it);
+        it = next;
+    }
+
+    if (entries_.size() >= capacity_)
+    {
+        erase(entries_.find(lru_.back()));
+    }
+
+    lru_.push_front(owner.hash().value());
+    entries_.emplace(owner.hash().value(), Entry { Route { via, owner }, lru_.begin() });
+}
+
+void LookupCache::remove(const Node &node)
+{
+    std::lock_guard lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end(); )
+    {
+        auto next = std::next(it);
+        if (it->second.route.via == node || it->second.route.owner == node)
+        {
+            erase(it);
+        }
+        it = next;
+    }
+}
+
+std::size_t LookupCache::size() const
+{
+    std::lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+void LookupCache::erase(Entries::iterator it)
+{
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
+} // namespace chord
@@ -0,0 +1,77 @@
+#ifndef __CHORD_LOOKUPCACHE_HPP__
+#define __CHORD_LOOKUPCACHE_HPP__
+
+#include "node.hpp"
+#include "hashtype.hpp"
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <cstddef>
+#include <optional>
+
+namespace chord
+{
+/**
+ * bounded LRU cache of the arcs of the ring learnt from lookups
+ *
+ * a lookup ends at the node whose successor owns the hash,
+ *  so each result tells the whole arc (via, owner]:
+ *  a later hash in it only needs to ask via by ClosestPre,
+ *  which either confirms the owner in one hop or redirects
+ *
+ * an arc is dropped when via or the owner times out or redirects,
+ *  all the methods are thread-safe
+*/
+class LookupCache
+{
+  public:
+    static constexpr std::size_t kDefaultCapacity = 1024;
+
+    struct Route
+    {
+        Node via;
+        Node owner;
+    };
+
+  public:
+    explicit LookupCache(std::size_t capacity = kDefaultCapacity);
+
+    std::optional<Route> find(const HashType &hash);
+    /**
+     * the arcs overlapping the new one are stale, so they are dropped
+    */
+    void insert(const Node &via, const Node &owner);
+    /**
+     * drop the arcs via or owned by the node
+    */
+    void remove(const Node &node);
+
+    std::size_t size() const;
+
+  private:
+    struct Entry
+    {
+        Route route;
+        std::list<std::size_t>::iterator lru;
+    };
+
+    using Entries = std::map<std::size_t, Entry>;
+    void erase(Entries::iterator it);
+
+  private:
+    std::size_t capacity_;
+    /**
+     * keyed by the hash of the owner, i.e. the end of the arc
+    */
+    Entries entries_;
+    /**
+     * the most recently used first
+    */
+    std::list<std::size_t> lru_;
+
+    mutable std::mutex mutex_;
+};
+} // namespace chord
+
+#endif
@@ -1,25 +1,149 @@
-#include "server.hpp"
+#include "host.hpp"
+#include "hasher.hpp"
 #include "instruction.hpp"
+#include "metricsserver.hpp"
 
+#include <chrono>
 #include <cassert>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <sstream>
 #include <iostream>
 #include <icarus/inetaddress.hpp>
 #include <icarus/eventloopthread.hpp>
 
 using namespace chord;
 
+namespace
+{
+bool parse_seconds(const std::string &text, double &seconds)
+{
+    char *end = nullptr;
+    seconds = std::strtod(text.c_str(), &end);
+    return !text.empty() && *end == '\0';
+}
+
+/**
+ * like stabilize:0.5:8,predecessor:1:16,fingers:1:32,compact:10:10
+ *  the routines left out keep their default periods,
+ *  and each min must be above 0 and at most its max
+*/
+bool set_periods(Host &host, const std::string &periods)
+{
+    std::istringstream in(periods);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        auto first = item.find(':');
+        auto second = item.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos)
+        {
+            return false;
+        }
+
+        auto name = item.substr(0, first);
+        Server::Routine routine;
+        if (name == "stabilize")
+        {
+            routine = Server::Stabilize;
+        }
+        else if (name == "predecessor")
+        {
+            routine = Server::CheckPredecessor;
+        }
+        else if (name == "fingers")
+        {
+            routine = Server::FixFingers;
+        }
+        else if (name == "compact")
+        {
+            routine = Server::CompactStore;
+        }
+        else
+        {
+            return false;
+        }
+
+        Server::Period period;
+        if (!parse_seconds(item.substr(first + 1, second - first - 1), period.min)
+            || !parse_seconds(item.substr(second + 1), period.max)
+            || !period.valid())
+        {
+            return false;
+        }
+        host.set_period(routine, period);
+    }
+    return true;
+}
+} // namespace
+
 int main(int argc, char *argv[])
 {
-    assert(argc == 3);
+    /**
+     * chord listen_ip listen_port [recursive|iterative] [successor_list_size] [weight]
+     *
+     * the hash of ids is xxh64 unless CHORD_HASH=sha1,
+     *  all the nodes of a ring must use the same one
+     *
+     * the metrics are served at 127.0.0.1:CHORD_METRICS_PORT if it's set
+     *
+     * the periods of the routines may be set by CHORD_PERIODS, see set_periods
+     *  and the timeouts in milliseconds by CHORD_LOOKUP_TIMEOUT and CHORD_PROBE_TIMEOUT
+    */
+    assert(argc >= 3 && argc <= 6);
+
+    if (auto name = std::getenv("CHORD_HASH"))
+    {
+        if (!Hasher::set_algorithm(name))
+        {
+            std::cout << "<ERROR> Unknown Hash " << name << std::endl;
+            return 1;
+        }
+    }
 
     auto listen_ip = argv[1];
     auto listen_port = static_cast<std::uint16_t>(std::stoi(argv[2]));
     icarus::InetAddress listen_addr(listen_ip, listen_port);
 
     icarus::EventLoop loop;
-    Server server(&loop, listen_addr);
+    Host host(&loop, listen_addr, argc == 6 ? std::stoul(argv[5]) : 1);
+    if (argc >= 4 && std::string(argv[3]) == "iterative")
+    {
+        host.set_lookup_mode(Server::Iterative);
+    }
+    if (argc >= 5)
+    {
+        host.set_successor_list_size(std::stoul(argv[4]));
+    }
+
+    if (auto periods = std::getenv("CHORD_PERIODS"))
+    {
+        if (!set_periods(host, periods))
+        {
+            std::cout << "<ERROR> Bad Periods " << periods << std::endl;
+            return 1;
+        }
+    }
+
+    if (auto time = std::getenv("CHORD_LOOKUP_TIMEOUT"))
+    {
+        host.set_lookup_timeout(std::chrono::milliseconds(std::stoul(time)));
+    }
+    if (auto time = std::getenv("CHORD_PROBE_TIMEOUT"))
+    {
+        host.set_probe_timeout(std::chrono::milliseconds(std::stoul(time)));
+    }
+
+    std::unique_ptr<MetricsServer> metrics_server;
+    if (auto port = std::getenv("CHORD_METRICS_PORT"))
+    {
+        metrics_server = std::make_unique<MetricsServer>(&loop,
+            icarus::InetAddress("127.0.0.1", static_cast<std::uint16_t>(std::stoi(port))));
+        metrics_server->start();
+    }
 
-    std::thread input_thread([&loop, &server]
+    std::thread input_thread([&loop, &host]
     {
         while (true)
         {
@@ -38,7 +162,7 @@ int main(int argc, char *argv[])
             else
             {
                 auto instruction = res.value();
-                server.handle_instruction(instruction);
+                host.handle_instruction(instruction);
                 if (instruction.type() == Instruction::Quit)
                 {
                     break;
@@ -49,7 +173,7 @@ int main(int argc, char *argv[])
 
     std::cout << "[SERVER STARTED] At " << listen_addr.to_ip_port() << std::endl;
 
-    server.start();
+    host.start();
     loop.loop();
     input_thread.join();
 
@@ -1,25 +1,178 @@
 #include "message.hpp"
 
+#include <charconv>
+#include <stdexcept>
+#include <arpa/inet.h>
+
 namespace chord
 {
+namespace
+{
+void put_uint(std::string &payload, std::uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i)
+    {
+        payload.push_back(static_cast<char>(value >> (i * 8)));
+    }
+}
+
+void put_number(std::string &payload, std::uint64_t value)
+{
+    payload.push_back(MessageView::Number);
+    put_uint(payload, value, 8);
+}
+
+void put_port(std::string &payload, std::uint16_t port)
+{
+    payload.push_back(MessageView::Port);
+    put_uint(payload, port, 2);
+}
+
+void put_ip(std::string &payload, const std::string &ip)
+{
+    in_addr addr{};
+    ::inet_pton(AF_INET, ip.c_str(), &addr);
+
+    payload.push_back(MessageView::Ip);
+    payload.append(reinterpret_cast<const char *>(&addr), sizeof(addr));
+}
+
+void put_string(std::string &payload, std::string_view str)
+{
+    if (str.size() > Message::kMaxString)
+    {
+        throw std::length_error("chord::Message: string param is too long");
+    }
+    payload.push_back(MessageView::String);
+    put_uint(payload, str.size(), 2);
+    payload.append(str.data(), str.size());
+}
+
+void put_bytes(std::string &payload, const char *data, std::size_t len)
+{
+    payload.push_back(MessageView::Bytes);
+    put_uint(payload, len, 4);
+    payload.append(data, len);
+}
+
+std::uint64_t get_uint(const char *data, std::size_t bytes)
+{
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < bytes; ++i)
+    {
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+    }
+    return value;
+}
+
+/**
+ * the size of the field at data, including its tag,
+ *  or zero if it's truncated or unknown
+*/
+std::size_t field_size(const char *data, std::size_t len)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    std::size_t size = 0;
+    switch (data[0])
+    {
+    case MessageView::Number:
+        size = 1 + 8;
+        break;
+    case MessageView::Port:
+        size = 1 + 2;
+        break;
+    case MessageView::Ip:
+        size = 1 + 4;
+        break;
+    case MessageView::String:
+        if (len < 3)
+        {
+            return 0;
+        }
+        size = 3 + get_uint(data + 1, 2);
+        break;
+    case MessageView::Bytes:
+        if (len < 5)
+        {
+            return 0;
+        }
+        size = 5 + get_uint(data + 1, 4);
+        break;
+    default:
+        return 0;
+    }
+
+    return size <= len ? size : 0;
+}
+
+std::uint64_t parse_number(std::string_view str)
+{
+    std::uint64_t value = 0;
+    std::from_chars(str.data(), str.data() + str.size(), value);
+    return value;
+}
+
+std::uint64_t number_of(MessageView::Tag tag, std::string_view data)
+{
+    switch (tag)
+    {
+    case MessageView::Number:
+    case MessageView::Port:
+        return get_uint(data.data(), data.size());
+    case MessageView::String:
+        return parse_number(data);
+    default:
+        return 0;
+    }
+}
+
+icarus::InetAddress addr_of(MessageView::Tag tag, std::string_view data, std::uint16_t port)
+{
+    char ip[INET_ADDRSTRLEN] = {};
+    if (tag == MessageView::Ip)
+    {
+        ::inet_ntop(AF_INET, data.data(), ip, sizeof(ip));
+    }
+    else if (tag == MessageView::String && data.size() < sizeof(ip))
+    {
+        data.copy(ip, data.size());
+    }
+    return icarus::InetAddress(ip, port);
+}
+} // namespace
+
 std::optional<Message> Message::parse(const std::string &message)
 {
+    if (message.empty())
+    {
+        return {};
+    }
     Type type = Type(message[0]);
-    if (type > Type::Put)
+    if (type < 0 || type > Message::kLastType)
     {
         return {};
     }
 
-    std::vector<std::string> params;
+    std::string payload;
+    std::string_view view(message);
     std::size_t pos = 1;
-    while (pos != message.npos)
+    while (pos < view.size())
     {
-        auto next_pos = message.find(',', pos + 1);
-        params.push_back(message.substr(pos + 1, next_pos - pos - 1));
+        auto next_pos = view.find(',', pos + 1);
+        auto param = view.substr(pos + 1, next_pos - pos - 1);
+        if (param.size() > kMaxString)
+        {
+            return {};
+        }
+        put_string(payload, param);
         pos = next_pos;
     }
 
-    return Message(type, std::move(params));
+    return from_payload(type, std::move(payload));
 }
 
 std::optional<Message> Message::parse(icarus::Buffer *buf)
@@ -36,67 +189,208 @@ std::optional<Message> Message::parse(icarus::Buffer *buf)
     return message;
 }
 
-Message::Message(Type type, std::uint16_t port)
+Message::Message(Type type)
   : type_(type)
-  , params_({std::to_string(port)})
 {
     // ...
 }
 
+Message::Message(Type type, std::uint16_t port)
+  : type_(type)
+{
+    put_port(payload_, port);
+}
+
 Message::Message(Type type, const icarus::InetAddress &addr)
   : type_(type)
-  , params_({addr.to_ip(), std::to_string(addr.to_port())})
 {
-    // ...
+    put_ip(payload_, addr.to_ip());
+    put_port(payload_, addr.to_port());
+}
+
+Message::Message(Type type, const icarus::InetAddress &addr, bool flag)
+  : type_(type)
+{
+    put_ip(payload_, addr.to_ip());
+    put_port(payload_, addr.to_port());
+    put_number(payload_, flag);
 }
 
 Message::Message(Type type, const HashType &hash)
   : type_(type)
-  , params_({hash.to_str()})
 {
-    // ...
+    put_number(payload_, hash.value());
 }
 
 Message::Message(const std::string &filename)
   : type_(Get)
-  , params_({filename})
 {
-    // ...
+    put_string(payload_, filename);
+}
+
+Message::Message(const std::string &filename, std::uint64_t offset, std::uint64_t length)
+  : type_(Get)
+{
+    put_string(payload_, filename);
+    put_number(payload_, offset);
+    put_number(payload_, length);
 }
 
 Message::Message(std::uint16_t port, const std::string &filename)
   : type_(Put)
-  , params_({std::to_string(port), filename})
+{
+    put_port(payload_, port);
+    put_string(payload_, filename);
+}
+
+Message::Message(Type type, const std::string &str)
+  : type_(type)
+{
+    put_string(payload_, str);
+}
+
+Message::Message(Type type, const char *data, std::size_t len)
+  : type_(type)
+{
+    payload_.reserve(5 + len);
+    put_bytes(payload_, data, len);
+}
+
+Message::Message(Type type, std::uint64_t number, bool flag)
+  : type_(type)
+{
+    put_number(payload_, number);
+    put_number(payload_, flag);
+}
+
+Message::Message(const MessageView &view)
+  : type_(view.type())
+  , payload_(view.payload())
 {
     // ...
 }
 
+Message &Message::add_number(std::uint64_t number)
+{
+    put_number(payload_, number);
+    return *this;
+}
+
+Message &Message::add_addr(const icarus::InetAddress &addr)
+{
+    put_ip(payload_, addr.to_ip());
+    put_port(payload_, addr.to_port());
+    return *this;
+}
+
+Message &Message::add_bytes(const char *data, std::size_t len)
+{
+    put_bytes(payload_, data, len);
+    return *this;
+}
+
 std::string Message::to_str() const
 {
     std::string result(1, char(type_));
-    for (auto &param : params_)
+    for (std::size_t pos = 0; pos < payload_.size(); )
     {
-        result += ',' + param;
+        auto data = payload_.data() + pos;
+        auto size = field_size(data, payload_.size() - pos);
+        if (size == 0)
+        {
+            break;
+        }
+
+        result += ',';
+        switch (data[0])
+        {
+        case MessageView::Number:
+            result += std::to_string(get_uint(data + 1, 8));
+            break;
+        case MessageView::Port:
+            result += std::to_string(get_uint(data + 1, 2));
+            break;
+        case MessageView::Ip:
+        {
+            char ip[INET_ADDRSTRLEN] = {};
+            ::inet_ntop(AF_INET, data + 1, ip, sizeof(ip));
+            result += ip;
+            break;
+        }
+        case MessageView::String:
+            result.append(data + 3, size - 3);
+            break;
+        case MessageView::Bytes:
+            result.append(data + 5, size - 5);
+            break;
+        }
+
+        pos += size;
     }
     return result + "\r\n";
 }
 
+std::string Message::to_frame() const
+{
+    std::string result;
+    result.reserve(MessageView::kHeaderSize + payload_.size());
+
+    result.push_back(MessageView::kMagic);
+    result.push_back(static_cast<char>(MessageView::kVersion));
+    result.push_back(char(type_));
+    put_uint(result, payload_.size(), 4);
+    result += payload_;
+
+    return result;
+}
+
+std::string Message::encode(bool binary) const
+{
+    return binary || has_bytes() ? to_frame() : to_str();
+}
+
+bool Message::has_bytes() const
+{
+    for (std::size_t pos = 0; pos < payload_.size(); )
+    {
+        auto data = payload_.data() + pos;
+        auto size = field_size(data, payload_.size() - pos);
+        if (size == 0)
+        {
+            break;
+        }
+        if (data[0] == MessageView::Bytes)
+        {
+            return true;
+        }
+        pos += size;
+    }
+    return false;
+}
+
 std::uint16_t Message::param_as_port(std::size_t i) const
 {
-    return static_cast<uint16_t>(std::stoi(params_[i]));
+    return view().param_as_port(i);
 }
 
 icarus::InetAddress Message::param_as_addr(std::size_t start) const
 {
-    return icarus::InetAddress(
-        params_[start].c_str(),
-        param_as_port(start + 1)
-    );
+    return view().param_as_addr(start);
 }
 
 HashType Message::param_as_hash(std::size_t i) const
 {
-    return HashType(std::stoull(params_[i]));
+    return view().param_as_hash(i);
+}
+
+bool Message::param_as_flag(std::size_t i) const
+{
+    return view().param_as_flag(i);
+}
+
+std::uint64_t Message::param_as_number(std::size_t i) const
+{
+    return view().param_as_number(i);
 }
 
 Message::Type Message::type() const
@@ -104,20 +398,223 @@ Message::Type Message::type() const
     return type_;
 }
 
-const std::vector<std::string> &Message::params() const
+MessageView Message::view() const
+{
+    return MessageView(type_, payload_.data(), payload_.size(), false);
+}
+
+std::string_view Message::operator[](std::size_t ind_of_param) const
+{
+    return view()[ind_of_param];
+}
+
+Message Message::from_payload(Type type, std::string payload)
 {
-    return params_;
+    Message msg(type);
+    msg.payload_ = std::move(payload);
+    return msg;
 }
 
-const std::string &Message::operator[](std::size_t ind_of_param) const
+bool MessageView::is_frame(const icarus::Buffer *buf)
 {
-    return params_[ind_of_param];
+    return buf->readable_bytes() > 0 && buf->peek()[0] == kMagic;
+}
+
+std::optional<MessageView> MessageView::parse(const icarus::Buffer *buf, bool &malformed)
+{
+    malformed = false;
+
+    auto data = buf->peek();
+    auto readable = buf->readable_bytes();
+    if (readable < kHeaderSize)
+    {
+        return {};
+    }
+
+    auto version = static_cast<unsigned char>(data[1]);
+    auto type = Message::Type(data[2]);
+    auto len = get_uint(data + 3, 4);
+    if (data[0] != kMagic || version == 0 || version > kVersion
+        || type < 0 || type > Message::kLastType || len > kMaxPayload)
+    {
+        malformed = true;
+        return {};
+    }
+
+    if (readable < kHeaderSize + len)
+    {
+        return {};
+    }
+
+    /**
+     * check all the fields once
+     *  then the accessors can walk them without checking
+    */
+    auto payload = data + kHeaderSize;
+    for (std::size_t pos = 0; pos < len; )
+    {
+        auto size = field_size(payload + pos, len - pos);
+        if (size == 0)
+        {
+            malformed = true;
+            return {};
+        }
+        pos += size;
+    }
+
+    return MessageView(type, payload, len, true);
 }
 
-Message::Message(Type type, std::vector<std::string> params)
+MessageView::MessageView(Message::Type type, const char *payload, std::size_t len, bool binary)
   : type_(type)
-  , params_(std::move(params))
+  , payload_(payload)
+  , len_(len)
+  , binary_(binary)
 {
     // ...
 }
+
+std::uint16_t MessageView::param_as_port(std::size_t i) const
+{
+    return static_cast<std::uint16_t>(param_as_number(i));
+}
+
+icarus::InetAddress MessageView::param_as_addr(std::size_t start) const
+{
+    auto [tag, data] = field(start);
+    return addr_of(tag, data, param_as_port(start + 1));
+}
+
+HashType MessageView::param_as_hash(std::size_t i) const
+{
+    return HashType(param_as_number(i));
+}
+
+bool MessageView::param_as_flag(std::size_t i) const
+{
+    return param_as_number(i) != 0;
+}
+
+std::uint64_t MessageView::param_as_number(std::size_t i) const
+{
+    auto [tag, data] = field(i);
+    return number_of(tag, data);
+}
+
+std::vector<HashType> MessageView::params_as_hashes(std::size_t first) const
+{
+    std::vector<HashType> hashes;
+    for (auto &[tag, data] : fields(first))
+    {
+        hashes.emplace_back(number_of(tag, data));
+    }
+    return hashes;
+}
+
+std::vector<icarus::InetAddress> MessageView::params_as_addrs(std::size_t first) const
+{
+    std::vector<icarus::InetAddress> addrs;
+    auto params = fields(first);
+    for (std::size_t i = 0; i + 1 < params.size(); i += 2)
+    {
+        addrs.push_back(addr_of(params[i].first, params[i].second,
+            static_cast<std::uint16_t>(number_of(params[i + 1].first, params[i + 1].second))));
+    }
+    return addrs;
+}
+
+Message::Type MessageView::type() const
+{
+    return type_;
+}
+
+bool MessageView::binary() const
+{
+    return binary_;
+}
+
+std::size_t MessageView::size() const
+{
+    std::size_t num = 0;
+    for (std::size_t pos = 0; pos < len_; ++num)
+    {
+        auto size = field_size(payload_ + pos, len_ - pos);
+        if (size == 0)
+        {
+            break;
+        }
+        pos += size;
+    }
+    return num;
+}
+
+std::size_t MessageView::frame_size() const
+{
+    return kHeaderSize + len_;
+}
+
+std::string_view MessageView::payload() const
+{
+    return std::string_view(payload_, len_);
+}
+
+std::string_view MessageView::operator[](std::size_t ind_of_param) const
+{
+    auto [tag, data] = field(ind_of_param);
+    return tag == String || tag == Bytes ? data : std::string_view();
+}
+
+std::pair<MessageView::Tag, std::string_view> MessageView::field(std::size_t i) const
+{
+    std::size_t pos = 0;
+    for (; i > 0 && pos < len_; --i)
+    {
+        auto size = field_size(payload_ + pos, len_ - pos);
+        if (size == 0)
+        {
+            return {Tag(0), std::string_view()};
+        }
+        pos += size;
+    }
+    if (pos >= len_ || field_size(payload_ + pos, len_ - pos) == 0)
+    {
+        return {Tag(0), std::string_view()};
+    }
+    return field_at(pos);
+}
+
+std::vector<std::pair<MessageView::Tag, std::string_view>> MessageView::fields(std::size_t first) const
+{
+    std::vector<std::pair<Tag, std::string_view>> result;
+    std::size_t pos = 0;
+    for (std::size_t i = 0; pos < len_; ++i)
+    {
+        auto size = field_size(payload_ + pos, len_ - pos);
+        if (size == 0)
+        {
+            break;
+        }
+        if (i >= first)
+        {
+            result.push_back(field_at(pos));
+        }
+        pos += size;
+    }
+    return result;
+}
+
+std::pair<MessageView::Tag, std::string_view> MessageView::field_at(std::size_t pos) const
+{
+    auto data = payload_ + pos;
+    auto size = field_size(data, len_ - pos);
+    if (data[0] == String)
+    {
+        return {String, std::string_view(data + 3, size - 3)};
+    }
+    if (data[0] == Bytes)
+    {
+        return {Bytes, std::string_view(data + 5, size - 5)};
+    }
+    return {Tag(data[0]), std::string_view(data + 1, size - 1)};
+}
 } // namespace chord
@@ -5,14 +5,21 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <optional>
+#include <string_view>
 #include <icarus/buffer.hpp>
 #include <icarus/inetaddress.hpp>
 
 namespace chord
 {
+class MessageView;
 /**
- * for messages, they are like `type,p1,p2,...,pn`
+ * for messages, they are like `type,p1,p2,...,pn` in text
+ *  or a binary frame, see MessageView
+ *
+ * params are kept encoded as binary fields,
+ *  the text is only produced for peers which don't speak binary
 */
 class Message
 {
@@ -22,43 +29,181 @@ class Message
     */
     enum Type : char
     {
-        Join, // ,src_port >> ,suc_ip,suc_port
-        FindSuc, // ,hash_value >> ,suc_ip,suc_port
+        Join, // ,src_port,hash_algorithm >> ,suc_ip,suc_port
+        FindSuc, // ,hash_value >> ,suc_ip,suc_port,via_ip,via_port,hops
 
-        PreNotify, // ,src_port >> ,pre_ip,pre_port
+        PreNotify, // ,src_port >> ,pre_ip,pre_port,suc_ip,suc_port,...
         SucNotify, // ,src_port >> ,suc_ip,suc_ip
 
         PreQuit, // ,pre_ip,pre_port
         SucQuit, // ,suc_ip,suc_port
 
-        Get, // ,file_name >> data
-        Put, // ,src_port,file_name
+        Get, // ,file_name[,offset,length] >> data
+        Put, // ,src_port,file_name >> ,size,stored
+
+        ClosestPre, // ,hash_value >> ,node_ip,node_port,is_successor
+
+        Hello, // ,version,hash_algorithm >> ,version,hash_algorithm
+
+        Fetch, // ,file_name[,offset,length[,version]] >> Data... DataEnd
+        Data, // ,bytes
+        DataEnd, // ,total_size,found,object_size,version,checksum
+
+        Migrate, // ,src_port,key,version,size,bytes,... >> ,count
+        FetchKey, // ,key >> Data... DataEnd
+
+        Fingers, // ,src_port >> ,node_ip,node_port,...
+        FindSucs, // ,hash_value,... >> ,suc_ip,suc_port,...
     };
+    static constexpr Type kLastType = FindSucs;
+    /**
+     * the longest string param, as its length takes 16 bits in a frame,
+     *  a longer one is rejected by parse, and by the constructors
+     *  which throw std::length_error for it
+    */
+    static constexpr std::size_t kMaxString = 0xFFFF;
 
+    /**
+     * parse the text format
+    */
     static std::optional<Message> parse(const std::string &message);
     static std::optional<Message> parse(icarus::Buffer *buf);
 
   public:
+    /**
+     * an empty message to be filled by the add methods
+    */
+    explicit Message(Type type);
     explicit Message(Type type, std::uint16_t port);
     explicit Message(Type type, const icarus::InetAddress &addr);
+    explicit Message(Type type, const icarus::InetAddress &addr, bool flag);
     explicit Message(Type type, const HashType &hash);
     explicit Message(const std::string &filename);
+    /**
+     * Get length bytes from offset of the file
+    */
+    explicit Message(const std::string &filename, std::uint64_t offset, std::uint64_t length);
     explicit Message(std::uint16_t port, const std::string &filename);
+    explicit Message(Type type, const std::string &str);
+    explicit Message(Type type, const char *data, std::size_t len);
+    explicit Message(Type type, std::uint64_t number, bool flag);
+    explicit Message(const MessageView &view);
+
+    Message &add_number(std::uint64_t number);
+    Message &add_addr(const icarus::InetAddress &addr);
+    Message &add_bytes(const char *data, std::size_t len);
 
     std::string to_str() const;
+    std::string to_frame() const;
+    /**
+     * a message with raw bytes is always a frame,
+     *  as they may hold the commas and the CRLF of the text
+    */
+    std::string encode(bool binary) const;
+    bool has_bytes() const;
+
     std::uint16_t       param_as_port(std::size_t i = 0) const;
     icarus::InetAddress param_as_addr(std::size_t start = 0) const;
     HashType            param_as_hash(std::size_t i = 0) const;
+    bool                param_as_flag(std::size_t i = 0) const;
+    std::uint64_t       param_as_number(std::size_t i = 0) const;
 
     Type type() const;
-    const std::vector<std::string> &params() const;
-    const std::string &operator[](std::size_t ind_of_param) const;
+    MessageView view() const;
+    std::string_view operator[](std::size_t ind_of_param) const;
 
   private:
-    Message(Type type, std::vector<std::string> params);
+    static Message from_payload(Type type, std::string payload);
 
     Type type_;
-    std::vector<std::string> params_;
+    std::string payload_;
+};
+
+/**
+ * a non-owning view of the params of a message
+ *  which reads them directly from the bytes, without any allocation
+ *
+ * a frame is `magic version type length payload`,
+ *  where length is the 32-bit big endian size of the payload
+ *  and the payload is a sequence of fields led by their tags:
+ *
+ *  'n' 64-bit number, 'p' 16-bit port, 'i' ipv4 address,
+ *  's' string prefixed by its 16-bit length,
+ *  'b' bytes prefixed by their 32-bit length
+*/
+class MessageView
+{
+  public:
+    static constexpr char kMagic = char(0xC4);
+    static constexpr std::uint16_t kVersion = 1;
+    static constexpr std::size_t kHeaderSize = 7;
+    static constexpr std::size_t kMaxPayload = 16 << 20;
+
+    enum Tag : char
+    {
+        Number = 'n',
+        Port = 'p',
+        Ip = 'i',
+        String = 's',
+        Bytes = 'b',
+    };
+
+    /**
+     * whether the buffer begins with a binary frame rather than text
+    */
+    static bool is_frame(const icarus::Buffer *buf);
+    /**
+     * return nothing if the frame is not complete yet,
+     *  or set malformed if it can never be parsed
+     *  the frame is left in the buffer, see frame_size
+    */
+    static std::optional<MessageView> parse(const icarus::Buffer *buf, bool &malformed);
+
+  public:
+    MessageView(Message::Type type, const char *payload, std::size_t len, bool binary);
+
+    std::uint16_t       param_as_port(std::size_t i = 0) const;
+    icarus::InetAddress param_as_addr(std::size_t start = 0) const;
+    HashType            param_as_hash(std::size_t i = 0) const;
+    bool                param_as_flag(std::size_t i = 0) const;
+    std::uint64_t       param_as_number(std::size_t i = 0) const;
+    /**
+     * all the params from the first one, in one pass over the payload
+     *  rather than one walk for each like the methods above,
+     *  for long lists such as the batches of FindSucs
+    */
+    std::vector<HashType>            params_as_hashes(std::size_t first = 0) const;
+    std::vector<icarus::InetAddress> params_as_addrs(std::size_t first = 0) const;
+
+    Message::Type type() const;
+    /**
+     * whether it came in a binary frame,
+     *  replies should be sent in the same format
+    */
+    bool binary() const;
+    std::size_t size() const;
+    std::size_t frame_size() const;
+    std::string_view payload() const;
+    /**
+     * only string and bytes params can be viewed as they are
+    */
+    std::string_view operator[](std::size_t ind_of_param) const;
+
+  private:
+    /**
+     * the tag and the data of the i-th field
+    */
+    std::pair<Tag, std::string_view> field(std::size_t i) const;
+    std::vector<std::pair<Tag, std::string_view>> fields(std::size_t first) const;
+    /**
+     * the field which begins at pos of the payload
+    */
+    std::pair<Tag, std::string_view> field_at(std::size_t pos) const;
+
+    Message::Type type_;
+    const char *payload_;
+    std::size_t len_;
+    bool binary_;
 };
 } // namespace chord
 
@@ -0,0 +1,266 @@
+#include "metrics.hpp"
+
+#include <sstream>
+#include <iomanip>
+
+namespace chord
+{
+namespace detail
+{
+std::size_t shard()
+{
+    static std::atomic<std::size_t> next(0);
+    thread_local std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return shard;
+}
+} // namespace detail
+
+namespace
+{
+const char *kTypeNames[Metrics::kTypes] =
+{
+    "join", "findsuc", "prenotify", "sucnotify", "prequit", "sucquit",
+    "get", "put", "closestpre", "hello", "fetch", "data", "dataend",
+    "migrate", "fetchkey", "fingers", "findsucs",
+};
+
+std::string upper_bound_of(std::size_t bucket, double scale)
+{
+    if (bucket + 1 == Histogram::kBuckets)
+    {
+        return "+Inf";
+    }
+
+    std::ostringstream out;
+    out << static_cast<double>(1ull << bucket) * scale;
+    return out.str();
+}
+
+/**
+ * a histogram in the text exposition format,
+ *  labels are like `type="join"` or empty
+*/
+void write_histogram(std::ostream &out, const std::string &name, const std::string &labels,
+    const Histogram::Sample &sample, double scale)
+{
+    auto prefix = labels.empty() ? std::string("{") : "{" + labels + ",";
+    auto suffix = labels.empty() ? std::string() : "{" + labels + "}";
+
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < Histogram::kBuckets; ++i)
+    {
+        cumulative += sample.buckets[i];
+        out << name << "_bucket" << prefix << "le=\"" << upper_bound_of(i, scale) << "\"} " << cumulative << "\n";
+    }
+    out << name << "_sum" << suffix << " " << static_cast<double>(sample.sum) * scale << "\n";
+    out << name << "_count" << suffix << " " << sample.count << "\n";
+}
+
+void write_summary(std::ostream &out, const std::string &name, const Histogram::Sample &sample, const char *unit)
+{
+    out << "\n[STATS] " << std::left << std::setw(24) << name
+        << " count " << sample.count;
+    if (sample.count == 0)
+    {
+        return;
+    }
+    out << " avg " << sample.sum / sample.count << unit
+        << " p50 " << sample.quantile(0.5) << unit
+        << " p99 " << sample.quantile(0.99) << unit;
+}
+} // namespace
+
+Counter::Counter()
+{
+    for (auto &shard : shards_)
+    {
+        shard.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Counter::add(std::uint64_t num)
+{
+    shards_[detail::shard()].value.fetch_add(num, std::memory_order_relaxed);
+}
+
+std::uint64_t Counter::value() const
+{
+    std::uint64_t sum = 0;
+    for (auto &shard : shards_)
+    {
+        sum += shard.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::uint64_t Histogram::Sample::quantile(double q) const
+{
+    auto rank = static_cast<std::uint64_t>(q * count);
+    std::uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i)
+    {
+        cumulative += buckets[i];
+        if (cumulative > rank)
+        {
+            return 1ull << i;
+        }
+    }
+    return 1ull << (kBuckets - 1);
+}
+
+Histogram::Histogram()
+{
+    for (auto &shard : shards_)
+    {
+        for (auto &bucket : shard.buckets)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        shard.sum.store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(std::uint64_t value)
+{
+    std::size_t bucket = value <= 1 ? 0 : 64 - __builtin_clzll(value - 1);
+    if (bucket >= kBuckets)
+    {
+        bucket = kBuckets - 1;
+    }
+
+    auto &shard = shards_[detail::shard()];
+    shard.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+Histogram::Sample Histogram::sample() const
+{
+    Sample sample{};
+    for (auto &shard : shards_)
+    {
+        for (std::size_t i = 0; i < kBuckets; ++i)
+        {
+            auto num = shard.buckets[i].load(std::memory_order_relaxed);
+            sample.buckets[i] += num;
+            sample.count += num;
+        }
+        sample.sum += shard.sum.load(std::memory_order_relaxed);
+    }
+    return sample;
+}
+
+ScopedTimer::ScopedTimer(Histogram &histogram, std::chrono::steady_clock::time_point start)
+  : histogram_(histogram)
+  , start_(start)
+{
+    // ...
+}
+
+ScopedTimer::~ScopedTimer()
+{
+    histogram_.observe(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start_
+    ).count());
+}
+
+Metrics &Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+const char *Metrics::type_name(std::size_t type)
+{
+    return kTypeNames[type];
+}
+
+std::string Metrics::to_prometheus() const
+{
+    constexpr double kSeconds = 1e-6;
+    std::ostringstream out;
+
+    out << "# TYPE chord_messages_handled_total counter\n";
+    for (std::size_t i = 0; i < kTypes; ++i)
+    {
+        out << "chord_messages_handled_total{type=\"" << kTypeNames[i] << "\"} " << handled[i].value() << "\n";
+    }
+
+    /**
+     * the types never seen are left out of the histograms
+    */
+    out << "# TYPE chord_handle_seconds histogram\n";
+    for (std::size_t i = 0; i < kTypes; ++i)
+    {
+        auto sample = handle_time[i].sample();
+        if (sample.count > 0)
+        {
+            write_histogram(out, "chord_handle_seconds", std::string("type=\"") + kTypeNames[i] + "\"", sample, kSeconds);
+        }
+    }
+    out << "# TYPE chord_request_seconds histogram\n";
+    for (std::size_t i = 0; i < kTypes; ++i)
+    {
+        auto sample = request_time[i].sample();
+        if (sample.count > 0)
+        {
+            write_histogram(out, "chord_request_seconds", std::string("type=\"") + kTypeNames[i] + "\"", sample, kSeconds);
+        }
+    }
+
+    out << "# TYPE chord_request_timeouts_total counter\n"
+        << "chord_request_timeouts_total " << request_timeouts.value() << "\n"
+        << "# TYPE chord_request_failures_total counter\n"
+        << "chord_request_failures_total " << request_failures.value() << "\n";
+
+    out << "# TYPE chord_lookup_hops histogram\n";
+    write_histogram(out, "chord_lookup_hops", "", lookup_hops.sample(), 1);
+    out << "# TYPE chord_lookup_seconds histogram\n";
+    write_histogram(out, "chord_lookup_seconds", "", lookup_time.sample(), kSeconds);
+
+    out << "# TYPE chord_transfer_bytes_total counter\n"
+        << "chord_transfer_bytes_total{op=\"get\",direction=\"received\"} " << get_received_bytes.value() << "\n"
+        << "chord_transfer_bytes_total{op=\"put\",direction=\"received\"} " << put_received_bytes.value() << "\n"
+        << "chord_transfer_bytes_total{op=\"serve\",direction=\"sent\"} " << sent_bytes.value() << "\n";
+
+    out << "# TYPE chord_stabilize_seconds histogram\n";
+    write_histogram(out, "chord_stabilize_seconds", "", stabilize_time.sample(), kSeconds);
+    out << "# TYPE chord_lock_wait_seconds histogram\n";
+    write_histogram(out, "chord_lock_wait_seconds", "", lock_wait_time.sample(), kSeconds);
+
+    return out.str();
+}
+
+std::string Metrics::to_text() const
+{
+    std::ostringstream out;
+    out << "[STATS] Of the process";
+
+    for (std::size_t i = 0; i < kTypes; ++i)
+    {
+        auto count = handled[i].value();
+        if (count > 0)
+        {
+            write_summary(out, std::string("handle ") + kTypeNames[i], handle_time[i].sample(), "us");
+        }
+    }
+    for (std::size_t i = 0; i < kTypes; ++i)
+    {
+        auto sample = request_time[i].sample();
+        if (sample.count > 0)
+        {
+            write_summary(out, std::string("request ") + kTypeNames[i], sample, "us");
+        }
+    }
+
+    write_summary(out, "lookup hops", lookup_hops.sample(), "");
+    write_summary(out, "lookup", lookup_time.sample(), "us");
+    write_summary(out, "stabilize", stabilize_time.sample(), "us");
+    write_summary(out, "lock wait", lock_wait_time.sample(), "us");
+
+    out << "\n[STATS] Timeouts " << request_timeouts.value()
+        << ", failures " << request_failures.value()
+        << "\n[STATS] Received " << get_received_bytes.value() << " bytes by get, "
+        << put_received_bytes.value() << " bytes by put, sent " << sent_bytes.value() << " bytes";
+    return out.str();
+}
+} // namespace chord
@@ -0,0 +1,163 @@
+#ifndef __CHORD_METRICS_HPP__
+#define __CHORD_METRICS_HPP__
+
+#include "message.hpp"
+
+#include <array>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace chord
+{
+namespace detail
+{
+constexpr std::size_t kShards = 8;
+
+/**
+ * the shard of the calling thread,
+ *  threads are spread over the shards round-robin
+*/
+std::size_t shard();
+} // namespace detail
+
+/**
+ * a monotonic counter, sharded by thread
+ *  so that concurrent updates rarely touch the same cache line
+*/
+class Counter
+{
+  public:
+    Counter();
+
+    void add(std::uint64_t num = 1);
+    std::uint64_t value() const;
+
+  private:
+    struct alignas(64) Shard
+    {
+        std::atomic<std::uint64_t> value;
+    };
+
+    std::array<Shard, detail::kShards> shards_;
+};
+
+/**
+ * a histogram with power-of-two buckets, sharded like Counter
+ *
+ * bucket i counts the values in (2^(i-1), 2^i],
+ *  the last one counts all the greater ones
+*/
+class Histogram
+{
+  public:
+    static constexpr std::size_t kBuckets = 32;
+
+    struct Sample
+    {
+        std::array<std::uint64_t, kBuckets> buckets;
+        std::uint64_t count;
+        std::uint64_t sum;
+
+        /**
+         * the upper bound of the bucket which holds the quantile
+        */
+        std::uint64_t quantile(double q) const;
+    };
+
+  public:
+    Histogram();
+
+    void observe(std::uint64_t value);
+    Sample sample() const;
+
+  private:
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<std::uint64_t>, kBuckets> buckets;
+        std::atomic<std::uint64_t> sum;
+    };
+
+    std::array<Shard, detail::kShards> shards_;
+};
+
+/**
+ * observe the time since it's created in microseconds
+*/
+class ScopedTimer
+{
+  public:
+    explicit ScopedTimer(Histogram &histogram,
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now());
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  private:
+    Histogram &histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * the metrics of the process, shared by all the virtual nodes
+ *
+ * recording is a relaxed atomic add on the shard of the thread,
+ *  so it's left on all the time
+ *
+ * times are in microseconds
+*/
+class Metrics
+{
+  public:
+    static constexpr std::size_t kTypes = Message::kLastType + 1;
+
+    static Metrics &instance();
+    /**
+     * the label of a message type, in lower case
+    */
+    static const char *type_name(std::size_t type);
+
+  public:
+    /**
+     * by the type of message, the handled ones are received by servers
+     *  and the requests are sent by the pool and answered by peers
+    */
+    std::array<Counter, kTypes> handled;
+    std::array<Histogram, kTypes> handle_time;
+    std::array<Histogram, kTypes> request_time;
+    Counter request_timeouts;
+    Counter request_failures;
+
+    /**
+     * of the lookups started by this node
+    */
+    Histogram lookup_hops;
+    Histogram lookup_time;
+
+    Counter get_received_bytes;
+    Counter put_received_bytes;
+    Counter sent_bytes;
+
+    Histogram stabilize_time;
+    /**
+     * the wait for the writer lock of the routing state
+    */
+    Histogram lock_wait_time;
+
+    /**
+     * the Prometheus text exposition format
+    */
+    std::string to_prometheus() const;
+    /**
+     * a summary for the stats instruction
+    */
+    std::string to_text() const;
+
+  private:
+    Metrics() = default;
+};
+} // namespace chord
+
+#endif
@@ -0,0 +1,44 @@
+#include "metrics.hpp"
+#include "metricsserver.hpp"
+
+#include <string_view>
+
+namespace chord
+{
+MetricsServer::MetricsServer(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr)
+  : tcp_server_(loop, listen_addr, "chord metrics")
+{
+    tcp_server_.set_message_callback([this] (const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
+    {
+        this->on_message(conn, buf);
+    });
+}
+
+void MetricsServer::start()
+{
+    tcp_server_.start();
+}
+
+/**
+ * answer once the header of the request is complete
+ *  and close the connection after it
+*/
+void MetricsServer::on_message(const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
+{
+    std::string_view request(buf->peek(), buf->readable_bytes());
+    if (request.find("\r\n\r\n") == std::string_view::npos)
+    {
+        return;
+    }
+    buf->retrieve_all();
+
+    auto body = Metrics::instance().to_prometheus();
+    conn->send(
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "\r\n" + body
+    );
+    conn->shutdown();
+}
+} // namespace chord
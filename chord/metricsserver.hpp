@@ -0,0 +1,34 @@
+#ifndef __CHORD_METRICSSERVER_HPP__
+#define __CHORD_METRICSSERVER_HPP__
+
+#include <icarus/buffer.hpp>
+#include <icarus/eventloop.hpp>
+#include <icarus/tcpserver.hpp>
+#include <icarus/inetaddress.hpp>
+#include <icarus/tcpconnection.hpp>
+
+namespace chord
+{
+/**
+ * serve Metrics in the Prometheus text format over plain HTTP,
+ *  whatever the path of the request is
+ *
+ * it runs in the given loop, a scrape only takes a snapshot
+ *  of the counters so it never blocks the nodes
+*/
+class MetricsServer
+{
+  public:
+    MetricsServer(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr);
+
+    void start();
+
+  private:
+    void on_message(const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf);
+
+  private:
+    icarus::TcpServer tcp_server_;
+};
+} // namespace chord
+
+#endif
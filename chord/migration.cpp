@@ -0,0 +1,125 @@
+#include "store.hpp"
+#include "client.hpp"
+#include "message.hpp"
+#include "migration.hpp"
+#include "ratelimiter.hpp"
+
+#include <thread>
+
+namespace chord
+{
+Migration::Migration(ConnectionPool &pool, Store &store, RateLimiter &rate,
+    std::uint16_t src_port, const icarus::InetAddress &dst_addr)
+  : pool_(pool)
+  , store_(store)
+  , rate_(rate)
+  , src_port_(src_port)
+  , dst_addr_(dst_addr)
+  , in_flight_(0)
+  , moved_(0)
+  , failed_(false)
+{
+    // ...
+}
+
+std::size_t Migration::run(const HashType &from, const HashType &to)
+{
+    Message batch(Message::Migrate, src_port_);
+    Keys keys;
+    std::size_t bytes = 0;
+    std::uint64_t size = 0;
+
+    for (auto &[key, entry] : store_.range(from, to))
+    {
+        /**
+         * the data of a large object is left for the receiver to pull
+        */
+        std::optional<std::string> data;
+        if (entry.size <= Store::kInlineSize)
+        {
+            data = store_.get(key);
+            if (!data.has_value())
+            {
+                continue;
+            }
+        }
+
+        batch.add_number(key).add_number(entry.version).add_number(entry.size);
+        batch.add_bytes(data.has_value() ? data->data() : nullptr, data.has_value() ? data->size() : 0);
+        keys.emplace_back(key, entry.version);
+        bytes += data.has_value() ? data->size() : 0;
+        size += entry.size;
+
+        if (bytes >= kBatchSize)
+        {
+            send(batch, std::move(keys), bytes, size);
+            batch = Message(Message::Migrate, src_port_);
+            keys.clear();
+            bytes = 0;
+            size = 0;
+        }
+    }
+    if (!keys.empty())
+    {
+        send(batch, std::move(keys), bytes, size);
+    }
+
+    std::unique_lock lock(mutex_);
+    cond_.wait(lock, [this]
+    {
+        return in_flight_ == 0;
+    });
+    return moved_;
+}
+
+void Migration::send(const Message &batch, Keys keys, std::size_t bytes, std::uint64_t size)
+{
+    {
+        std::unique_lock lock(mutex_);
+        cond_.wait(lock, [this]
+        {
+            return in_flight_ < kWindow;
+        });
+        if (failed_)
+        {
+            return;
+        }
+        ++in_flight_;
+    }
+    std::this_thread::sleep_until(rate_.charge(bytes));
+
+    /**
+     * the receiver answers after pulling the large objects,
+     *  which may wait for the other transfers sharing the rate
+    */
+    auto pull = std::chrono::milliseconds(2 * (size - bytes) * 1000 / rate_.rate());
+    Client client(pool_, dst_addr_, kAckTimeout + pull);
+    client.send_and_wait_response(batch, [this, keys = std::move(keys)] (bool timeout, const std::optional<Message> &result)
+    {
+        /**
+         * the objects are kept here unless all of them are stored there
+        */
+        auto done = !timeout && result->param_as_number() == keys.size();
+        if (done)
+        {
+            for (auto &[key, version] : keys)
+            {
+                store_.remove(key, version);
+            }
+        }
+
+        std::lock_guard lock(mutex_);
+        if (done)
+        {
+            moved_ += keys.size();
+        }
+        else
+        {
+            failed_ = true;
+        }
+        --in_flight_;
+        cond_.notify_all();
+    });
+}
+
+} // namespace chord
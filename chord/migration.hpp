@@ -0,0 +1,78 @@
+#ifndef __CHORD_MIGRATION_HPP__
+#define __CHORD_MIGRATION_HPP__
+
+#include "hashtype.hpp"
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+#include <icarus/inetaddress.hpp>
+
+namespace chord
+{
+class Store;
+class Message;
+class RateLimiter;
+class ConnectionPool;
+/**
+ * hand the objects of a key range over to another node
+ *
+ * small objects go in Migrate batches, a few of which are in flight at once,
+ *  large ones are only announced and pulled by the receiver with FetchKey
+ *  an object is removed here once its batch is acknowledged
+ *
+ * the batches and the FetchKey transfers are paced by one limiter
+ *  of kRate so that lookups are not starved,
+ *  it blocks, so it must not run in the loop of the pool
+*/
+class Migration
+{
+  public:
+    static constexpr std::size_t kBatchSize = 256 * 1024;
+    static constexpr std::size_t kWindow = 4;
+    /**
+     * bytes per second
+    */
+    static constexpr std::size_t kRate = 16 << 20;
+    /**
+     * the time to acknowledge a batch,
+     *  on top of pulling its large objects at the rate
+    */
+    static constexpr std::chrono::seconds kAckTimeout{10};
+
+  public:
+    Migration(ConnectionPool &pool, Store &store, RateLimiter &rate,
+        std::uint16_t src_port, const icarus::InetAddress &dst_addr);
+
+    /**
+     * move the objects in (from, to], or all of them if from equals to
+     *  return the number of objects moved
+    */
+    std::size_t run(const HashType &from, const HashType &to);
+
+  private:
+    using Keys = std::vector<std::pair<HashType, std::uint64_t>>;
+
+    /**
+     * bytes are sent in the batch, and size is of all its objects
+    */
+    void send(const Message &batch, Keys keys, std::size_t bytes, std::uint64_t size);
+
+  private:
+    ConnectionPool &pool_;
+    Store &store_;
+    RateLimiter &rate_;
+    std::uint16_t src_port_;
+    icarus::InetAddress dst_addr_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::size_t in_flight_;
+    std::size_t moved_;
+    bool failed_;
+};
+} // namespace chord
+
+#endif
@@ -0,0 +1,67 @@
+#include "proximity.hpp"
+
+#include <algorithm>
+
+namespace chord
+{
+void Proximity::record(const Node &node, Duration rtt)
+{
+    std::lock_guard lock(mutex_);
+    auto [it, inserted] = rtts_.emplace(node.hash().value(), rtt);
+    if (!inserted)
+    {
+        it->second += (rtt - it->second) / 8;
+    }
+}
+
+std::optional<Proximity::Duration> Proximity::rtt(const Node &node) const
+{
+    std::lock_guard lock(mutex_);
+    auto it = rtts_.find(node.hash().value());
+    if (it == rtts_.end())
+    {
+        return {};
+    }
+    return it->second;
+}
+
+Node Proximity::choose(std::size_t ind, const std::vector<Node> &candidates)
+{
+    std::lock_guard lock(mutex_);
+    auto &kept = candidates_[ind];
+    for (auto &node : candidates)
+    {
+        if (std::find(kept.begin(), kept.end(), node) == kept.end())
+        {
+            kept.push_back(node);
+        }
+    }
+
+    std::stable_sort(kept.begin(), kept.end(), [this] (const Node &lhs, const Node &rhs)
+    {
+        return rtt_or_max(lhs) < rtt_or_max(rhs);
+    });
+    if (kept.size() > kCandidates)
+    {
+        kept.erase(kept.begin() + kCandidates, kept.end());
+    }
+
+    return kept.front();
+}
+
+void Proximity::remove(const Node &node)
+{
+    std::lock_guard lock(mutex_);
+    rtts_.erase(node.hash().value());
+    for (auto &kept : candidates_)
+    {
+        kept.erase(std::remove(kept.begin(), kept.end(), node), kept.end());
+    }
+}
+
+Proximity::Duration Proximity::rtt_or_max(const Node &node) const
+{
+    auto it = rtts_.find(node.hash().value());
+    return it == rtts_.end() ? Duration::max() : it->second;
+}
+} // namespace chord
@@ -0,0 +1,63 @@
+#ifndef __CHORD_PROXIMITY_HPP__
+#define __CHORD_PROXIMITY_HPP__
+
+#include "node.hpp"
+#include "fingertable.hpp"
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+
+namespace chord
+{
+/**
+ * round-trip times to peers, measured on the stabilization traffic,
+ *  and a few candidates for each finger
+ *
+ * any node in [self + 2^i, self + 2^(i+1)) makes the same progress
+ *  as finger i, so the one which is the fastest to reach is chosen
+ *  rather than the first one (proximity neighbor selection)
+ *
+ * all the methods are thread-safe
+*/
+class Proximity
+{
+  public:
+    static constexpr std::size_t kCandidates = 3;
+
+    using Duration = std::chrono::microseconds;
+
+  public:
+    /**
+     * smoothed like the rtt of TCP, each sample weighs 1/8
+    */
+    void record(const Node &node, Duration rtt);
+    std::optional<Duration> rtt(const Node &node) const;
+
+    /**
+     * merge the candidates found for finger i with the kept ones,
+     *  and return the one with the lowest rtt
+     *
+     * the candidates must not be empty
+    */
+    Node choose(std::size_t ind, const std::vector<Node> &candidates);
+    void remove(const Node &node);
+
+  private:
+    /**
+     * unmeasured nodes are the slowest
+    */
+    Duration rtt_or_max(const Node &node) const;
+
+  private:
+    std::unordered_map<std::size_t, Duration> rtts_;
+    std::array<std::vector<Node>, FingerTable::M> candidates_;
+
+    mutable std::mutex mutex_;
+};
+} // namespace chord
+
+#endif
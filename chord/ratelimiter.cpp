@@ -0,0 +1,27 @@
+#include "ratelimiter.hpp"
+
+#include <algorithm>
+
+namespace chord
+{
+RateLimiter::RateLimiter(std::size_t rate)
+  : rate_(rate)
+  , next_(std::chrono::steady_clock::now())
+{
+    // ...
+}
+
+std::chrono::steady_clock::time_point RateLimiter::charge(std::size_t bytes)
+{
+    auto cost = std::chrono::microseconds(static_cast<std::uint64_t>(bytes) * 1000000 / rate_);
+
+    std::lock_guard lock(mutex_);
+    next_ = std::max(next_, std::chrono::steady_clock::now()) + cost;
+    return next_;
+}
+
+std::size_t RateLimiter::rate() const
+{
+    return rate_;
+}
+} // namespace chord
@@ -0,0 +1,39 @@
+#ifndef __CHORD_RATELIMITER_HPP__
+#define __CHORD_RATELIMITER_HPP__
+
+#include <mutex>
+#include <chrono>
+#include <cstddef>
+
+namespace chord
+{
+/**
+ * a budget of bytes per second shared by several transfers,
+ *  each of them charges its bytes before sending them
+ *  and waits until they are due, in its own way
+ *
+ * all the methods are thread-safe
+*/
+class RateLimiter
+{
+  public:
+    explicit RateLimiter(std::size_t rate);
+
+    RateLimiter(const RateLimiter &) = delete;
+    RateLimiter &operator=(const RateLimiter &) = delete;
+
+    /**
+     * return the time before which the bytes must not be sent,
+     *  the unused budget of an idle period is not saved up
+    */
+    std::chrono::steady_clock::time_point charge(std::size_t bytes);
+    std::size_t rate() const;
+
+  private:
+    std::size_t rate_;
+    std::chrono::steady_clock::time_point next_;
+    std::mutex mutex_;
+};
+} // namespace chord
+
+#endif
@@ -0,0 +1,22 @@
+#include "routing.hpp"
+
+namespace chord
+{
+Routing::Routing(const icarus::InetAddress &addr, std::size_t successor_list_size)
+  : predecessor(addr)
+  , table(addr)
+  , successors(predecessor, successor_list_size)
+{
+    // ...
+}
+
+const Node &Routing::self() const
+{
+    return table.self();
+}
+
+const Node &Routing::successor() const
+{
+    return table[0];
+}
+} // namespace chord
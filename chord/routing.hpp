@@ -0,0 +1,30 @@
+#ifndef __CHORD_ROUTING_HPP__
+#define __CHORD_ROUTING_HPP__
+
+#include "node.hpp"
+#include "fingertable.hpp"
+#include "successorlist.hpp"
+
+#include <icarus/inetaddress.hpp>
+
+namespace chord
+{
+/**
+ * the routing state of a node,
+ *  published by Server as a whole in a Snapshot
+ *  so that lookups never wait for stabilization
+*/
+struct Routing
+{
+    Routing(const icarus::InetAddress &addr, std::size_t successor_list_size = SuccessorList::kDefaultSize);
+
+    const Node &self() const;
+    const Node &successor() const;
+
+    Node predecessor;
+    FingerTable table;
+    SuccessorList successors;
+};
+} // namespace chord
+
+#endif
@@ -1,11 +1,23 @@
 #include "client.hpp"
+#include "hasher.hpp"
+#include "lookup.hpp"
 #include "server.hpp"
+#include "metrics.hpp"
+#include "filesender.hpp"
+#include "migration.hpp"
+#include "stripedfetch.hpp"
 #include "instruction.hpp"
 
+#include <map>
 #include <ctime>
 #include <thread>
+#include <dirent.h>
+#include <sstream>
+#include <iomanip>
+#include <sys/stat.h>
+#include <vector>
 #include <chrono>
-#include <random>
+#include <future>
 #include <fstream>
 #include <iostream>
 #include <icarus/buffer.hpp>
@@ -13,14 +25,130 @@
 
 namespace chord
 {
-Server::Server(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr)
-  : predecessor_(listen_addr)
-  , table_(listen_addr)
+namespace
+{
+bool is_dir(const std::string &path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/**
+ * `[-j concurrency] name...` of mget and mput,
+ *  a directory stands for the regular files right in it
+*/
+bool parse_file_list(const std::string &value, std::vector<std::string> &filenames, std::size_t &concurrency)
+{
+    std::istringstream in(value);
+    std::string name;
+    while (in >> name)
+    {
+        if (name == "-j")
+        {
+            if (!(in >> concurrency) || concurrency == 0)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        if (name.size() > Message::kMaxString)
+        {
+            return false;
+        }
+        if (!is_dir(name))
+        {
+            filenames.push_back(name);
+            continue;
+        }
+
+        auto dir = ::opendir(name.c_str());
+        if (dir == nullptr)
+        {
+            return false;
+        }
+        while (auto ent = ::readdir(dir))
+        {
+            auto path = name + "/" + ent->d_name;
+            struct stat st;
+            if (path.size() <= Message::kMaxString && ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            {
+                filenames.push_back(path);
+            }
+        }
+        ::closedir(dir);
+    }
+    return !filenames.empty();
+}
+} // namespace
+
+Server::Period Server::default_period(Routine routine)
+{
+    switch (routine)
+    {
+    case Stabilize:
+        return {0.5, 8};
+    case CheckPredecessor:
+        return {1, 16};
+    case FixFingers:
+        return {1, 32};
+    case CompactStore:
+        return {10, 10};
+    }
+    return {1, 1};
+}
+
+Server::Server(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr,
+    ConnectionPool &pool, Store &store)
+  : self_(listen_addr)
+  , routing_(Routing(listen_addr), &Metrics::instance().lock_wait_time)
   , established_(false)
+  , lookup_mode_(Recursive)
+  , lookup_alpha_(3)
+  , lookup_timeout_(kLookupTimeout)
+  , probe_timeout_(kProbeTimeout)
   , loop_(loop)
   , listen_addr_(listen_addr)
   , tcp_server_(loop, listen_addr, "chord server")
+  , pool_(pool)
+  , store_(store)
+  , migration_rate_(Migration::kRate)
+  , churn_(0)
+  , seen_churn_{}
+  , compacting_(false)
 {
+    /**
+     * a routine reports a change if there has been churn since its last run
+    */
+    for (std::size_t i = 0; i < kRoutines; ++i)
+    {
+        auto routine = static_cast<Routine>(i);
+        auto period = default_period(routine);
+        timers_[i] = std::make_unique<AdaptiveTimer>(loop, period.min, period.max, [this, routine]
+        {
+            switch (routine)
+            {
+            case Stabilize:
+                notify_successor();
+                break;
+            case CheckPredecessor:
+                notify_predecessor();
+                break;
+            case FixFingers:
+                fix_finger_table();
+                break;
+            case CompactStore:
+                compact_store();
+                break;
+            }
+
+            auto churn = churn_.load();
+            auto changed = churn != seen_churn_[routine];
+            seen_churn_[routine] = churn;
+            return changed;
+        });
+    }
+
     tcp_server_.set_thread_num(10);
     tcp_server_.set_message_callback([this] (const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
     {
@@ -33,6 +161,99 @@ void Server::start()
     tcp_server_.start();
 }
 
+void Server::set_thread_num(int num)
+{
+    tcp_server_.set_thread_num(num);
+}
+
+void Server::set_local_check(LocalCheck is_local)
+{
+    is_local_ = std::move(is_local);
+}
+
+bool Server::established() const
+{
+    return established_;
+}
+
+std::shared_ptr<const Routing> Server::routing() const
+{
+    return routing_.get();
+}
+
+const icarus::InetAddress &Server::listen_addr() const
+{
+    return listen_addr_;
+}
+
+/**
+ * join the ring by any node in it
+*/
+bool Server::join(const icarus::InetAddress &dst_addr)
+{
+    std::cout << "[CONNECTING]" << std::endl;
+
+    Client client(pool_, dst_addr, std::chrono::seconds(1));
+
+    /**
+     * the keys would be owned by different nodes in the eyes of each,
+     *  a peer which doesn't tell its hash is let through
+    */
+    auto hello = client.send_and_wait_response(Message(
+        Message::Hello, MessageView::kVersion
+    ).add_number(Hasher::algorithm()));
+    if (hello.has_value() && hello->type() == Message::Hello && hello->view().size() >= 2
+        && hello->param_as_number(1) != Hasher::algorithm())
+    {
+        std::cout << "[FAILED CONNECTION] The ring hashes with "
+            << Hasher::name(Hasher::Algorithm(hello->param_as_number(1)))
+            << " rather than " << Hasher::name(Hasher::algorithm()) << std::endl;
+        return false;
+    }
+
+    auto result = client.send_and_wait_response(Message(
+        Message::Join, listen_addr_.to_port()
+    ).add_number(Hasher::algorithm()));
+
+    if (!result.has_value())
+    {
+        std::cout << "[FAILED CONNECTION]" << std::endl;
+        return false;
+    }
+
+    auto msg = result.value();
+
+    Node successor(msg.param_as_addr());
+    routing_.update([&successor] (Routing &routing)
+    {
+        routing.table.set(0, successor);
+        routing.table.insert(successor);
+        routing.successors.update(successor, {});
+    });
+
+    std::cout << "[ESTABILISHED SUCCESSFULLY]" << std::endl;
+    std::cout << "[SUCCESSOR] Is " << successor.addr().to_ip_port() << std::endl;
+    established_ = true;
+    start_stabilize();
+
+    /**
+     * the copied fingers are verified by a full refresh at once,
+     *  rather than one by one in the later rounds
+    */
+    bootstrap_fingers(successor);
+    fix_finger_table();
+
+    return true;
+}
+
+void Server::self_boot()
+{
+    established_ = true;
+    start_stabilize();
+
+    std::cout << "[SELF BOOT]" << std::endl;
+}
+
 /**
  * quit: broadcast to set the predecessor's successor
  *  and the successor's predecessor
@@ -43,27 +264,100 @@ void Server::stop()
     {
         return;
     }
+
+    /**
+     * hand the range of self over to the successor first,
+     *  this node keeps serving until the large objects are pulled
+    */
+    auto routing = routing_.get();
+    if (routing->successor() != self() && !is_local(routing->successor().addr()))
+    {
+        migrate(routing->predecessor == self() ? self().hash() : routing->predecessor.hash(),
+            self().hash(), routing->successor().addr());
+    }
     established_ = false;
 
-    if (successor() != self())
+    /**
+     * the neighbours may have changed during the migration
+    */
+    routing = routing_.get();
+    if (routing->successor() != self())
     {
-        Client(successor().addr()).send(Message(
-            Message::PreQuit, predecessor_.addr()
+        Client(pool_, routing->successor().addr()).send(Message(
+            Message::PreQuit, routing->predecessor.addr()
         ));
     }
 
-    if (predecessor_ != self())
+    if (routing->predecessor != self())
     {
-        Client(predecessor_.addr()).send(Message(
-            Message::SucQuit, successor().addr()
+        Client(pool_, routing->predecessor.addr()).send(Message(
+            Message::SucQuit, routing->successor().addr()
         ));
     }
+
+    /**
+     * forget the ring, so that it can join again later
+    */
+    routing_.update([this] (Routing &routing)
+    {
+        routing = Routing(listen_addr_, routing.successors.max_size());
+    });
+    stop_stabilize();
 }
 
-void Server::handle_instruction(const Instruction &ins)
+/**
+ * the connections are closed as soon as anything arrives
+ *  and stabilization skips its rounds, see on_message
+*/
+void Server::halt()
+{
+    established_ = false;
+    stop_stabilize();
+}
+
+void Server::set_lookup_mode(LookupMode mode)
+{
+    lookup_mode_ = mode;
+}
+
+void Server::set_lookup_alpha(std::size_t alpha)
+{
+    lookup_alpha_ = alpha;
+}
+
+void Server::set_lookup_timeout(std::chrono::milliseconds time)
+{
+    lookup_timeout_ = time;
+}
+
+void Server::set_probe_timeout(std::chrono::milliseconds time)
+{
+    probe_timeout_ = time;
+}
+
+void Server::set_period(Routine routine, Period period)
+{
+    loop_->run_in_loop([this, routine, period]
+    {
+        timers_[routine]->set_period(period.min, period.max);
+    });
+}
+
+void Server::set_successor_list_size(std::size_t size)
 {
-    std::lock_guard lock(mutex_);
+    routing_.update([size] (Routing &routing)
+    {
+        routing.successors.set_size(size);
+    });
+}
 
+/**
+ * instructions are handled in the input thread,
+ *  they read the routing state from a snapshot
+ *  and never wait for peers while updating it
+*/
+void Server::handle_instruction(const Instruction &ins)
+{
     switch (ins.type())
     {
     case Instruction::Join:
@@ -89,6 +383,24 @@ void Server::handle_instruction(const Instruction &ins)
     case Instruction::Print:
         handle_instruction_print();
         break;
+
+    case Instruction::Stats:
+        handle_instruction_stats();
+        break;
+
+    case Instruction::MGet:
+        handle_instruction_mget(ins.value());
+        break;
+
+    case Instruction::MPut:
+        handle_instruction_mput(ins.value());
+        break;
+
+    case Instruction::Weight:
+        /**
+         * the weight is of the host, see Host
+        */
+        break;
     }
 }
 
@@ -99,69 +411,45 @@ void Server::handle_instruction_join(const std::string &value)
     auto dst_port = static_cast<std::uint16_t>(std::stoi(value.substr(pos + 1)));
     auto dst_addr = icarus::InetAddress(dst_ip.c_str(), dst_port);
 
-    std::cout << "[CONNECTING]" << std::endl;
-
-    Client client(dst_addr, std::chrono::seconds(1));
-    auto result = client.send_and_wait_response(Message(
-        Message::Join, listen_addr_.to_port()
-    ));
-
-    if (result.has_value())
-    {
-        auto msg = result.value();
-
-        Node successor(msg.param_as_addr());
-        this->successor() = successor;
-        this->table_.insert(successor);
-
-        std::cout << "[ESTABILISHED SUCCESSFULLY]" << std::endl;
-        std::cout << "[SUCCESSOR] Is " << successor.addr().to_ip_port() << std::endl;
-        established_ = true;
-
-        std::thread stabilize_thread([this]
-        {
-            this->stabilize();
-        });
-        stabilize_thread.detach();
-    }
-    else
-    {
-        std::cout << "[FAILED CONNECTION]" << std::endl;
-    }
+    join(dst_addr);
 }
 
 void Server::handle_instruction_get(const std::string &value)
 {
-    auto hash = std::hash<std::string>{}(value);
-    auto server_addr = find_successor(hash).param_as_addr();
-    if (HashType(server_addr) == HashType(listen_addr_))
+    auto key = HashType::of(value);
+    auto server_addr = find_successor(key).param_as_addr();
+    if (is_local(server_addr))
     {
+        auto size = export_object(key, value);
+        if (size.has_value())
+        {
+            std::cout << "[GET SUCCESSFULLY] Copy file: " << value
+                << " from the local store with " << size.value() << " bytes" << std::endl;
+        }
         return;
     }
 
-    std::cout << "[GET] File whose hash is " << hash << std::endl;
+    std::cout << "[GET] File whose hash is " << key.value() << std::endl;
 
     /**
      * filename cannot involve ','
      *  and assume the file exists
     */
-    std::thread get_thread([server_addr, filename = value]
+    std::thread get_thread([this, key, server_addr, filename = value]
     {
-        Client client(server_addr);
-        std::ofstream out(filename);
         time_t start = time(nullptr);
-        if (!client.send_and_wait_stream(Message(filename), out))
+        auto file_size = get_file(key, filename, server_addr);
+        if (!file_size.has_value())
         {
-            std::cout << "[FAILED GET] No such file: " << filename << std::endl;
+            std::cout << "[FAILED GET] No such file or truncated: " << filename << std::endl;
         }
         else
         {
             time_t end = time(nullptr);
-            auto file_size = out.tellp();
             std::cout
                 << "[GET SUCCESSFULLY] Download file: " << filename
                 << " in " << end - start << " seconds"
-                << " with " << file_size << " bytes"
+                << " with " << file_size.value() << " bytes"
                 << std::endl;
         }
     });
@@ -170,49 +458,129 @@ void Server::handle_instruction_get(const std::string &value)
 
 void Server::handle_instruction_put(const std::string &value)
 {
-    auto hash = std::hash<std::string>{}(value);
-    auto peer_addr = find_successor(hash).param_as_addr();
-    if (HashType(peer_addr) != HashType(listen_addr_))
+    auto key = HashType::of(value);
+    auto peer_addr = find_successor(key).param_as_addr();
+    if (is_local(peer_addr))
     {
-        std::cout << "[PUT] File whose hash is " << hash
+        if (import_object(key, value).has_value())
+        {
+            std::cout << "[PUT] File " << value << " to the local store" << std::endl;
+        }
+    }
+    else
+    {
+        std::cout << "[PUT] File whose hash is " << key.value()
             << " to node " << peer_addr.to_ip_port() << std::endl
         ;
-        Client(peer_addr).send(Message(listen_addr_.to_port(), value));
+
+        /**
+         * the owner answers once it has pulled the file,
+         *  the connection is kept busy until then
+        */
+        Client(pool_, peer_addr).send_and_wait_response(Message(listen_addr_.to_port(), value),
+            [filename = value] (bool timeout, const std::optional<Message> &result)
+            {
+                if (timeout || !result->param_as_flag(1))
+                {
+                    std::cout << "[FAILED PUT] Of file " << filename << std::endl;
+                }
+            }
+        );
     }
 }
 
-void Server::handle_instruction_quit()
+/**
+ * the files are fetched in a thread of their own,
+ *  so that the input thread is free meanwhile
+*/
+void Server::handle_instruction_mget(const std::string &value)
 {
-    stop();
-    loop_->quit();
+    std::vector<std::string> filenames;
+    std::size_t concurrency = kBulkConcurrency;
+    if (!parse_file_list(value, filenames, concurrency))
+    {
+        std::cout << "<ERROR> Bad File List " << value << std::endl;
+        return;
+    }
+
+    std::thread mget_thread([this, filenames = std::move(filenames), concurrency]
+    {
+        transfer_files(false, filenames, concurrency);
+    });
+    mget_thread.detach();
 }
 
-void Server::handle_instruction_selfboot()
+void Server::handle_instruction_mput(const std::string &value)
 {
-    established_ = true;
-    std::thread stabilize_thread([this]
+    std::vector<std::string> filenames;
+    std::size_t concurrency = kBulkConcurrency;
+    if (!parse_file_list(value, filenames, concurrency))
+    {
+        std::cout << "<ERROR> Bad File List " << value << std::endl;
+        return;
+    }
+
+    std::thread mput_thread([this, filenames = std::move(filenames), concurrency]
     {
-        this->stabilize();
+        transfer_files(true, filenames, concurrency);
     });
-    stabilize_thread.detach();
+    mput_thread.detach();
+}
 
-    std::cout << "[SELF BOOT]" << std::endl;
+void Server::handle_instruction_quit()
+{
+    stop();
+
+    /**
+     * the quit messages are sent by the pool in the loop,
+     *  give them a moment before the loop stops
+    */
+    loop_->run_after(1, [loop = loop_]
+    {
+        loop->quit();
+    });
+}
+
+void Server::handle_instruction_selfboot()
+{
+    self_boot();
 }
 
 void Server::handle_instruction_print()
 {
+    auto routing = routing_.get();
+
     std::cout << "[PRINT] Self is " << listen_addr_.to_ip_port()
-        << "\n[PRINT] Predecessor is " << predecessor_.addr().to_ip_port()
-        << "\n[PRINT] Successor is " << successor().addr().to_ip_port();
+        << "\n[PRINT] Predecessor is " << routing->predecessor.addr().to_ip_port()
+        << "\n[PRINT] Successor is " << routing->successor().addr().to_ip_port();
+
+    for (auto &node : routing->successors.nodes())
+    {
+        std::cout << "\n[PRINT] Successor list has " << node.addr().to_ip_port();
+    }
 
-    auto &nodes = table_.nodes();
-    for (std::size_t i = 0; i < nodes.size(); ++i)
+    for (std::size_t i = 0; i < FingerTable::M; ++i)
     {
-        std::cout << "\n[PRINT] |" << i << "|" << nodes[i].hash().to_str() << "|" << nodes[i].addr().to_ip_port();
+        auto &node = routing->table[i];
+        std::cout << "\n[PRINT] |" << i << "|" << node.hash().to_str() << "|" << node.addr().to_ip_port();
+
+        auto rtt = proximity_.rtt(node);
+        if (rtt.has_value())
+        {
+            std::cout << "|" << rtt->count() << "us";
+        }
     }
     std::cout << std::endl;
 }
 
+/**
+ * the metrics are of the process, see Metrics
+*/
+void Server::handle_instruction_stats()
+{
+    std::cout << Metrics::instance().to_text() << std::endl;
+}
+
 void Server::on_message(const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf)
 {
     if (!established_)
@@ -221,76 +589,191 @@ void Server::on_message(const icarus::TcpConnectionPtr &conn, icarus::Buffer *bu
         return;
     }
 
-    std::lock_guard lock(mutex_);
-
-    auto res = Message::parse(buf);
-    if (!res.has_value())
+    /**
+     * connections from peers are kept alive by their pools
+     *  so there may be several messages in the buffer,
+     *  each of them may be a binary frame or a text line
+    */
+    while (buf->readable_bytes() > 0)
     {
-        return;
+        if (MessageView::is_frame(buf))
+        {
+            bool malformed = false;
+            auto view = MessageView::parse(buf, malformed);
+            if (malformed)
+            {
+                conn->force_close();
+                return;
+            }
+            if (!view.has_value())
+            {
+                return;
+            }
+
+            /**
+             * the view points into the buffer,
+             *  so it can only be retrieved after dispatching
+            */
+            auto keep = dispatch(conn, view.value());
+            buf->retrieve(view->frame_size());
+            if (!keep)
+            {
+                return;
+            }
+            continue;
+        }
+
+        if (buf->findCRLF() == nullptr)
+        {
+            return;
+        }
+
+        auto res = Message::parse(buf);
+        if (!res.has_value())
+        {
+            continue;
+        }
+
+        if (!dispatch(conn, res->view()))
+        {
+            return;
+        }
     }
+}
+
+bool Server::dispatch(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    auto &metrics = Metrics::instance();
+    metrics.handled[msg.type()].add();
+    ScopedTimer timer(metrics.handle_time[msg.type()]);
 
-    auto &message = res.value();
-    switch (message.type())
+    switch (msg.type())
     {
     case Message::Join:
-        on_message_join(conn, message);
+        on_message_join(conn, msg);
         break;
     case Message::FindSuc:
-        on_message_findsuc(conn, message);
+        on_message_findsuc(conn, msg);
         break;
 
     case Message::PreNotify:
-        on_message_prenotify(conn, message);
+        on_message_prenotify(conn, msg);
         break;
     case Message::SucNotify:
-        on_message_sucnotify(conn, message);
+        on_message_sucnotify(conn, msg);
         break;
 
     case Message::PreQuit:
-        on_message_prequit(conn, message);
+        on_message_prequit(conn, msg);
         break;
     case Message::SucQuit:
-        on_message_sucquit(conn, message);
+        on_message_sucquit(conn, msg);
         break;
 
     case Message::Get:
-        on_message_get(conn, message);
-        break;
+        on_message_get(conn, msg);
+        /**
+         * the end of data is marked by closing the connection,
+         *  which is shut down by the sender after all data is sent
+        */
+        return false;
     case Message::Put:
-        on_message_put(conn, message);
+        on_message_put(conn, msg);
         break;
-    }
-
-    /**
-     * force close connection after sending messages
-     *  because shutdown only shutdown writing
-    */
-    conn->force_close();
-}
+    case Message::Fetch:
+        on_message_fetch(conn, msg);
+        return false;
+    case Message::FetchKey:
+        on_message_fetchkey(conn, msg);
+        return false;
+    case Message::Migrate:
+        on_message_migrate(conn, msg);
+        break;
+    case Message::Data:
+    case Message::DataEnd:
+        /**
+         * only sent by the serving side of a transfer
+        */
+        conn->force_close();
+        return false;
 
-void Server::on_message_join(const icarus::TcpConnectionPtr &conn, const Message &msg)
-{
-    auto src_ip = conn->peer_address().to_ip();
-    auto src_port = msg.param_as_port();
-    auto src_addr = icarus::InetAddress(src_ip.c_str(), src_port);
-    conn->send(find_successor(src_addr).to_str());
+    case Message::ClosestPre:
+        on_message_closestpre(conn, msg);
+        break;
+    case Message::Hello:
+        on_message_hello(conn, msg);
+        break;
+    case Message::Fingers:
+        on_message_fingers(conn, msg);
+        break;
+    case Message::FindSucs:
+        on_message_findsucs(conn, msg);
+        break;
+    }
 
-    std::cout << "[RECEIVE JOIN] From " << src_addr.to_ip_port() << std::endl;
+    return true;
 }
 
-void Server::on_message_prenotify(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void Server::on_message_join(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
     auto src_ip = conn->peer_address().to_ip();
     auto src_port = msg.param_as_port();
     auto src_addr = icarus::InetAddress(src_ip.c_str(), src_port);
-    auto src_node = Node(src_addr);
 
-    if (src_node.between(predecessor_, self()))
+    if (msg.size() >= 2 && msg.param_as_number(1) != Hasher::algorithm())
     {
-        update_predecessor(src_node);
+        std::cout << "[REFUSE JOIN] From " << src_addr.to_ip_port() << " which hashes with "
+            << Hasher::name(Hasher::Algorithm(msg.param_as_number(1))) << std::endl;
+        conn->force_close();
+        return;
     }
 
-    conn->send(Message(Message::PreNotify, predecessor_.addr()).to_str());
+    /**
+     * the reply is sent when the lookup finishes,
+     *  the io thread is free to handle other messages meanwhile
+    */
+    find_successor(src_addr, [conn, binary = msg.binary()] (const Message &result)
+    {
+        conn->send(result.encode(binary));
+    });
+
+    std::cout << "[RECEIVE JOIN] From " << src_addr.to_ip_port() << std::endl;
+}
+
+void Server::on_message_prenotify(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    auto src_ip = conn->peer_address().to_ip();
+    auto src_port = msg.param_as_port();
+    auto src_addr = icarus::InetAddress(src_ip.c_str(), src_port);
+    auto src_node = Node(src_addr);
+
+    /**
+     * most notifications change nothing,
+     *  so the writer lock is only taken for a new predecessor
+    */
+    auto routing = routing_.get();
+    if (src_node.between(routing->predecessor, self()))
+    {
+        routing_.update([this, &src_node] (Routing &routing)
+        {
+            if (src_node.between(routing.predecessor, self()))
+            {
+                update_predecessor(routing, src_node);
+            }
+        });
+        routing = routing_.get();
+    }
+
+    /**
+     * the successor list of self goes along,
+     *  the peer builds its own from it
+    */
+    Message result(Message::PreNotify, routing->predecessor.addr());
+    for (auto &node : routing->successors.nodes())
+    {
+        result.add_addr(node.addr());
+    }
+    conn->send(result.encode(msg.binary()));
 
     // std::cout << "[RECEIVE NOTIFY] From " << src_addr.to_ip_port() << std::endl;
 }
@@ -298,61 +781,153 @@ void Server::on_message_prenotify(const icarus::TcpConnectionPtr &conn, const Me
 /**
  * only keep alive
 */
-void Server::on_message_sucnotify(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void Server::on_message_sucnotify(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
-    conn->send(Message(Message::SucNotify, successor().addr()).to_str());
+    conn->send(Message(Message::SucNotify, routing_.get()->successor().addr()).encode(msg.binary()));
 }
 
-void Server::on_message_findsuc(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void Server::on_message_findsuc(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
     /**
      * msg[0] is the hash value
     */
-    conn->send(find_successor(msg.param_as_hash()).to_str());
+    auto hash = msg.param_as_hash();
+    find_successor(hash, [conn, binary = msg.binary()] (const Message &result)
+    {
+        conn->send(result.encode(binary));
+    });
 
-    std::cout << "[RECEIVE FindSuc] Finds " << msg[0] << std::endl;
+    std::cout << "[RECEIVE FindSuc] Finds " << hash.to_str() << std::endl;
 }
 
-void Server::on_message_prequit(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void Server::on_message_prequit(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
-    table_.remove(predecessor_);
-    update_predecessor(msg.param_as_addr());
+    Node new_predecessor(msg.param_as_addr());
+    routing_.update([this, &new_predecessor] (Routing &routing)
+    {
+        routing.table.remove(routing.predecessor);
+        update_predecessor(routing, new_predecessor);
+    });
 }
 
-void Server::on_message_sucquit(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void Server::on_message_sucquit(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
-    table_.remove(successor());
-    update_successor(msg.param_as_addr());
+    Node new_successor(msg.param_as_addr());
+    routing_.update([this, &new_successor] (Routing &routing)
+    {
+        auto old_successor = routing.successor();
+        routing.successors.remove(old_successor);
+        routing.table.remove(old_successor);
+        update_successor(routing, new_successor);
+    });
 }
 
-void Server::on_message_get(const icarus::TcpConnectionPtr &conn, const Message &msg)
+void Server::on_message_get(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
-    std::cout << "[RECEIVE Get] Of file " << msg[0] << std::endl;
+    std::string filename(msg[0]);
+    std::cout << "[RECEIVE Get] Of file " << filename << std::endl;
+
+    auto ranged = msg.size() >= 3;
+    auto sender = open_object(filename,
+        ranged ? msg.param_as_number(1) : 0, ranged ? msg.param_as_number(2) : UINT64_MAX);
+    if (!sender)
+    {
+        conn->shutdown();
+        return;
+    }
+
+    sender->start(conn);
+}
+
+/**
+ * same as Get but the data is framed,
+ *  and the end of the file is marked by a DataEnd frame
+*/
+void Server::on_message_fetch(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    std::string filename(msg[0]);
+    std::cout << "[RECEIVE Fetch] Of file " << filename << std::endl;
 
     /**
-     * assume the file exists
+     * a range of the object if the offset and the length are given,
+     *  only that version in the store if it's given too
     */
-    std::ifstream file(msg[0]);
-
-    if (!file.is_open())
+    auto ranged = msg.size() >= 3;
+    auto sender = open_object(filename,
+        ranged ? msg.param_as_number(1) : 0, ranged ? msg.param_as_number(2) : UINT64_MAX,
+        msg.size() >= 4 ? std::optional(msg.param_as_number(3)) : std::nullopt);
+    if (!sender)
     {
+        FileSender::not_found(conn);
         return;
     }
 
-    std::string data;
-    while (!file.eof())
+    sender->start(conn, true);
+}
+
+void Server::on_message_fetchkey(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    auto location = store_.locate(msg.param_as_hash());
+    auto sender = location.has_value()
+        ? FileSender::open(location->path, location->offset, location->size)
+        : nullptr;
+    if (!sender)
     {
-        data.push_back(file.get());
+        FileSender::not_found(conn);
+        return;
     }
     /**
-     * see https://en.cppreference.com/w/cpp/io/basic_ios/eof
+     * only asked by a node receiving a migration from here
     */
-    data.pop_back();
+    sender->set_rate_limiter(&migration_rate_);
 
-    conn->send(data);
+    sender->start(conn, true);
 }
 
-void Server::on_message_put(const icarus::TcpConnectionPtr &conn, const Message &msg)
+/**
+ * the objects are stored in a thread of its own,
+ *  and the large ones are pulled from the sender,
+ *  then the number of stored objects is replied
+*/
+void Server::on_message_migrate(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    auto src_ip = conn->peer_address().to_ip();
+    auto src_addr = icarus::InetAddress(src_ip.c_str(), msg.param_as_port());
+
+    std::thread migrate_thread([this, conn, src_addr, batch = Message(msg), binary = msg.binary()]
+    {
+        std::size_t count = 0;
+        auto fields = batch.view().size();
+        for (std::size_t i = 1; i + 3 < fields; i += 4)
+        {
+            auto key = batch.param_as_hash(i);
+            auto version = batch.param_as_number(i + 1);
+            auto size = batch.param_as_number(i + 2);
+            auto data = batch[i + 3];
+
+            if (data.size() == size)
+            {
+                count += store_.put(key, data.data(), data.size(), version);
+                continue;
+            }
+
+            auto writer = store_.writer(key, version);
+            auto received = Client(pool_, src_addr).fetch(Message(
+                Message::FetchKey, key
+            ), [&writer] (const char *data, std::size_t len)
+            {
+                return writer->append(data, len);
+            });
+            count += received.has_value() && writer->commit();
+        }
+
+        std::cout << "[RECEIVE Migrate] " << count << " objects from " << src_addr.to_ip_port() << std::endl;
+        conn->send(Message(Message::Migrate).add_number(count).encode(binary));
+    });
+    migrate_thread.detach();
+}
+
+void Server::on_message_put(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
     std::cout << "[RECEIVE Put] Of file " << msg[1] << std::endl;
 
@@ -360,39 +935,468 @@ void Server::on_message_put(const icarus::TcpConnectionPtr &conn, const Message
     auto server_port = msg.param_as_port();
     auto server_addr = icarus::InetAddress(server_ip.c_str(), server_port);
 
-    std::thread get_thread([server_addr, filename = msg[1]]
+    /**
+     * the object is written to the store as it arrives
+     *  and becomes visible only if it arrives completely
+    */
+    std::thread get_thread([this, conn, binary = msg.binary(), server_addr, filename = std::string(msg[1])]
     {
-        Client client(server_addr);
-        std::ofstream out(filename);
-        client.send_and_wait_stream(Message(filename), out);
+        Client client(pool_, server_addr);
+        auto writer = store_.writer(HashType::of(filename));
+        auto size = client.fetch(Message(Message::Fetch, filename), [&writer] (const char *data, std::size_t len)
+        {
+            return writer->append(data, len);
+        });
+        if (!size.has_value() || !writer->commit())
+        {
+            std::cout << "[FAILED Put] Of file " << filename << std::endl;
+            conn->send(Message(Message::Put, std::uint64_t(0), false).encode(binary));
+            return;
+        }
+        Metrics::instance().put_received_bytes.add(size.value());
+        conn->send(Message(Message::Put, size.value(), true).encode(binary));
     });
     get_thread.detach();
 }
 
 /**
- * in stabilization:
- *  1. ask the predecessor of the successor
- *  2. update the successor by the got predecessor
- *      if the predecessor of the successor is not self
+ * one step of an iterative lookup:
+ *  answer the successor if the hash falls in (self, successor]
+ *  otherwise the closest preceding finger to ask next
 */
-void Server::stabilize()
+void Server::on_message_closestpre(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
 {
-    while (true)
+    auto hash = msg.param_as_hash();
+
+    auto routing = routing_.get();
+    auto &successor = routing->successor();
+    if (hash == self().hash() || hash.between(self().hash(), successor.hash()))
+    {
+        conn->send(Message(Message::ClosestPre, successor.addr(), true).encode(msg.binary()));
+        return;
+    }
+
+    auto &next_node = routing->table.find_closest_pre(hash);
+    if (next_node == self())
     {
-        std::this_thread::sleep_for(std::chrono::seconds(2));
+        conn->send(Message(Message::ClosestPre, successor.addr(), false).encode(msg.binary()));
+        return;
+    }
+    conn->send(Message(Message::ClosestPre, next_node.addr(), false).encode(msg.binary()));
+}
+
+/**
+ * the version is answered in the format it is asked,
+ *  the peer switches to binary frames if both support them
+*/
+void Server::on_message_hello(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    conn->send(Message(Message::Hello, MessageView::kVersion)
+        .add_number(Hasher::algorithm()).encode(msg.binary()));
+}
+
+/**
+ * the distinct fingers and the successor list,
+ *  for a node which has just joined before self, see bootstrap_fingers
+*/
+void Server::on_message_fingers(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    auto routing = routing_.get();
+    Message result(Message::Fingers);
+    for (auto &node : routing->table.nodes())
+    {
+        result.add_addr(node.addr());
+    }
+    for (auto &node : routing->successors.nodes())
+    {
+        result.add_addr(node.addr());
+    }
+    conn->send(result.encode(msg.binary()));
+}
 
-        if (!established_)
+void Server::on_message_findsucs(const icarus::TcpConnectionPtr &conn, const MessageView &msg)
+{
+    auto hashes = msg.params_as_hashes();
+    std::cout << "[RECEIVE FindSucs] Finds " << hashes.size() << " keys" << std::endl;
+
+    find_successors(std::move(hashes), [conn, binary = msg.binary()] (std::vector<Node> owners)
+    {
+        Message result(Message::FindSucs);
+        for (auto &owner : owners)
         {
-            continue;
+            result.add_addr(owner.addr());
         }
+        conn->send(result.encode(binary));
+    });
+}
+
+/**
+ * the object in the store, or the local file of the same name
+ *  which this node is putting to its owner,
+ *  no other file is served so a peer cannot read any path it names
+*/
+std::shared_ptr<FileSender> Server::open_object(const std::string &filename,
+    std::uint64_t offset, std::uint64_t length, std::optional<std::uint64_t> version)
+{
+    std::string path = filename;
+    std::uint64_t base = 0;
+    std::uint64_t size = 0;
+
+    struct stat st;
+    auto location = store_.locate(HashType::of(filename));
+    if (location.has_value() && version.value_or(location->version) == location->version)
+    {
+        path = location->path;
+        base = location->offset;
+        size = location->size;
+    }
+    else if (version.has_value())
+    {
+        return nullptr;
+    }
+    else if (is_putting(filename) && ::stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+    {
+        size = static_cast<std::uint64_t>(st.st_size);
+    }
+    else
+    {
+        return nullptr;
+    }
 
+    if (offset > size)
+    {
+        return nullptr;
+    }
+    auto sender = FileSender::open(path, base + offset, std::min(length, size - offset));
+    if (sender)
+    {
+        sender->set_object_size(size);
+        if (location.has_value())
         {
-            std::lock_guard lock(mutex_);
-            notify_predecessor();
-            notify_successor();
-            fix_finger_table();
+            sender->set_version(location->version, location->checksum);
         }
     }
+    return sender;
+}
+
+bool Server::is_putting(const std::string &filename)
+{
+    std::lock_guard lock(putting_mutex_);
+    return putting_.count(filename) > 0;
+}
+
+std::optional<std::size_t> Server::import_object(const HashType &key, const std::string &filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        return {};
+    }
+
+    auto writer = store_.writer(key);
+    std::vector<char> buf(FileSender::kChunkSize);
+    std::size_t size = 0;
+    while (in.read(buf.data(), buf.size()) || in.gcount() > 0)
+    {
+        if (!writer->append(buf.data(), in.gcount()))
+        {
+            return {};
+        }
+        size += in.gcount();
+    }
+    if (!writer->commit())
+    {
+        return {};
+    }
+    return size;
+}
+
+std::optional<std::size_t> Server::export_object(const HashType &key, const std::string &filename)
+{
+    auto location = store_.locate(key);
+    if (!location.has_value())
+    {
+        return {};
+    }
+
+    std::ifstream in(location->path, std::ios::binary);
+    std::ofstream out(filename, std::ios::binary);
+    in.seekg(location->offset);
+
+    std::vector<char> buf(FileSender::kChunkSize);
+    for (auto left = location->size; left > 0; )
+    {
+        auto len = std::min<std::uint64_t>(buf.size(), left);
+        if (!in.read(buf.data(), len) || !out.write(buf.data(), len))
+        {
+            return {};
+        }
+        left -= len;
+    }
+    return location->size;
+}
+
+std::optional<std::size_t> Server::get_file(const HashType &key, const std::string &filename,
+    const icarus::InetAddress &owner)
+{
+    if (is_local(owner))
+    {
+        return export_object(key, filename);
+    }
+
+    /**
+     * the head of the object comes from the owner,
+     *  which tells whether it's large enough to be striped,
+     *  it's longer if a part is left by an interrupted get
+    */
+    Client client(pool_, owner);
+    ObjectInfo object;
+    auto size = client.fetch_file(filename, filename, StripedFetch::kMinSize, &object);
+    if (size.has_value())
+    {
+        Metrics::instance().get_received_bytes.add(size.value());
+    }
+    if (size.has_value() && object.size > size.value())
+    {
+        /**
+         * an object the owner doesn't serve from its store
+         *  cannot be matched at another node, so only the owner sends it
+        */
+        auto head = size.value();
+        auto holders = object.version != 0
+            ? find_holders(owner, filename, object) : std::vector<icarus::InetAddress>{owner};
+        StripedFetch fetch(pool_, filename, object, std::move(holders), head);
+        size.reset();
+        if (fetch.run(filename).has_value())
+        {
+            Metrics::instance().get_received_bytes.add(object.size - head);
+            size = object.size;
+        }
+    }
+
+    if (!size.has_value())
+    {
+        /**
+         * the owner may have changed, look it up in full next time
+        */
+        cache_.remove(Node(owner));
+        return {};
+    }
+    return size;
+}
+
+std::optional<std::size_t> Server::put_file(const HashType &key, const std::string &filename,
+    const icarus::InetAddress &owner)
+{
+    if (is_local(owner))
+    {
+        return import_object(key, filename);
+    }
+
+    /**
+     * the owner fetches the file from here before it responds
+    */
+    {
+        std::lock_guard lock(putting_mutex_);
+        putting_.insert(filename);
+    }
+    Client client(pool_, owner);
+    auto result = client.send_and_wait_response(Message(listen_addr_.to_port(), filename));
+    {
+        std::lock_guard lock(putting_mutex_);
+        putting_.erase(putting_.find(filename));
+    }
+    if (!result.has_value() || result->type() != Message::Put || !result->param_as_flag(1))
+    {
+        cache_.remove(Node(owner));
+        return {};
+    }
+    return result->param_as_number(0);
+}
+
+/**
+ * no object is replicated by the ring itself yet,
+ *  but the old owner keeps it until its handoff is acknowledged,
+ *  see Migration, and the holders are found the same way once it is
+ *
+ * the successors of the owner are walked by SucNotify
+ *  and asked for the version in their stores by a range of none of it,
+ *  a holder must have the same checksum as the owner too
+*/
+std::vector<icarus::InetAddress> Server::find_holders(const icarus::InetAddress &owner,
+    const std::string &filename, const ObjectInfo &object)
+{
+    std::vector<icarus::InetAddress> holders {owner};
+    auto node = owner;
+    for (std::size_t k = 1; k < StripedFetch::kMaxSources; ++k)
+    {
+        Client client(pool_, node, probe_timeout_);
+        auto result = client.send_and_wait_response(Message(Message::SucNotify, listen_addr_.to_port()));
+        if (!result.has_value())
+        {
+            break;
+        }
+
+        node = result->param_as_addr();
+        if (Node(node) == Node(owner))
+        {
+            break;
+        }
+        auto held = Client(pool_, node).probe(filename, object.version);
+        if (held.has_value() && held->size == object.size && held->checksum == object.checksum)
+        {
+            holders.push_back(node);
+        }
+    }
+    return holders;
+}
+
+/**
+ * the owners are looked up in one batch, see find_successors
+ *
+ * the files of each owner are queued together and the owners take turns,
+ *  so the workers spread over the owners, and the puts to one owner
+ *  reuse the pooled connections to it
+*/
+void Server::transfer_files(bool put, const std::vector<std::string> &filenames, std::size_t concurrency)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<HashType> keys;
+    for (auto &filename : filenames)
+    {
+        keys.push_back(HashType::of(filename));
+    }
+    auto owners = find_successors(keys);
+
+    std::map<HashType, std::vector<std::size_t>> groups;
+    for (std::size_t i = 0; i < filenames.size(); ++i)
+    {
+        groups[owners[i].hash()].push_back(i);
+    }
+
+    std::vector<std::size_t> queue;
+    for (std::size_t round = 0; queue.size() < filenames.size(); ++round)
+    {
+        for (auto &[owner, inds] : groups)
+        {
+            if (round < inds.size())
+            {
+                queue.push_back(inds[round]);
+            }
+        }
+    }
+
+    std::atomic<std::size_t> next(0);
+    std::atomic<std::size_t> done(0);
+    std::atomic<std::uint64_t> bytes(0);
+    std::vector<std::thread> workers;
+    for (std::size_t k = 0; k < std::min(concurrency, queue.size()); ++k)
+    {
+        workers.emplace_back([&]
+        {
+            for (auto i = next++; i < queue.size(); i = next++)
+            {
+                auto ind = queue[i];
+                auto size = put
+                    ? put_file(keys[ind], filenames[ind], owners[ind].addr())
+                    : get_file(keys[ind], filenames[ind], owners[ind].addr());
+                if (!size.has_value())
+                {
+                    std::cout << (put ? "[FAILED PUT] Of file " : "[FAILED GET] No such file or truncated: ")
+                        << filenames[ind] << std::endl;
+                    continue;
+                }
+                ++done;
+                bytes += size.value();
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << (put ? "[MPUT] " : "[MGET] ") << done << " of " << filenames.size() << " files"
+        << " with " << bytes << " bytes across " << groups.size() << " nodes"
+        << std::fixed << std::setprecision(3)
+        << " in " << elapsed.count() << " seconds, "
+        << bytes / elapsed.count() / (1 << 20) << " MiB/s"
+        << std::defaultfloat << std::endl;
+}
+
+std::size_t Server::migrate(const HashType &from, const HashType &to, const icarus::InetAddress &dst_addr)
+{
+    Migration migration(pool_, store_, migration_rate_, listen_addr_.to_port(), dst_addr);
+    auto moved = migration.run(from, to);
+
+    std::cout << "[MIGRATE] " << moved << " objects to " << dst_addr.to_ip_port() << std::endl;
+    return moved;
+}
+
+bool Server::is_local(const icarus::InetAddress &addr) const
+{
+    return HashType(addr) == self().hash() || (is_local_ && is_local_(addr));
+}
+
+/**
+ * the routines only send requests and apply the answers in the loop,
+ *  so they never block it, except compaction which has a thread
+ *
+ * starting again is harmless, so join and self-boot may be repeated
+*/
+void Server::start_stabilize()
+{
+    loop_->run_in_loop([this]
+    {
+        for (auto &timer : timers_)
+        {
+            timer->start();
+        }
+    });
+}
+
+void Server::stop_stabilize()
+{
+    loop_->run_in_loop([this]
+    {
+        for (auto &timer : timers_)
+        {
+            timer->stop();
+        }
+    });
+}
+
+/**
+ * at most one compaction at a time,
+ *  the store may be shared by several nodes though
+*/
+void Server::compact_store()
+{
+    if (compacting_.exchange(true))
+    {
+        return;
+    }
+
+    std::thread compact_thread([this]
+    {
+        store_.compact();
+        compacting_ = false;
+    });
+    compact_thread.detach();
+}
+
+void Server::note_churn()
+{
+    ++churn_;
+    loop_->queue_in_loop([this]
+    {
+        for (auto &timer : timers_)
+        {
+            timer->tighten();
+        }
+    });
 }
 
 /**
@@ -400,38 +1404,65 @@ void Server::stabilize()
 */
 void Server::notify_predecessor()
 {
-    if (predecessor_ == self())
+    auto predecessor = routing_.get()->predecessor;
+    if (predecessor == self())
     {
         return;
     }
 
-    Client client(predecessor_.addr(), std::chrono::seconds(1));
-    auto result = client.send_and_wait_response(Message(
+    Client client(pool_, predecessor.addr(), probe_timeout_);
+    client.send_and_wait_response(Message(
         Message::SucNotify,
         listen_addr_.to_port()
-    ));
-
-    if (!result.has_value())
+    ), [this, predecessor, start = std::chrono::steady_clock::now()] (bool timeout, const std::optional<Message> &result)
     {
-        table_.remove(predecessor_);
-        update_predecessor(table_.find_closest_pre(self()));
-    }
+        if (!timeout)
+        {
+            record_rtt(predecessor, start);
+            return;
+        }
+
+        routing_.update([this, &predecessor] (Routing &routing)
+        {
+            remove_node(routing, predecessor);
+            if (routing.predecessor == predecessor)
+            {
+                update_predecessor(routing, routing.table.find_closest_pre(self()));
+            }
+        });
+    });
 }
 
+/**
+ * in stabilization:
+ *  1. ask the predecessor of the successor
+ *  2. update the successor by the got predecessor
+ *      if the predecessor of the successor is not self
+ *      otherwise copy the successor list from it
+*/
 void Server::notify_successor()
 {
+    auto routing = routing_.get();
     /**
      * check the predecessor directly if the successor is self
     */
-    if (successor() == self())
+    if (routing->successor() == self())
     {
-        auto new_successor = predecessor_;
-        if (new_successor.between(self(), successor()))
+        if (routing->predecessor != self())
         {
-            update_successor(new_successor);
+            routing_.update([this] (Routing &routing)
+            {
+                auto new_successor = routing.predecessor;
+                if (routing.successor() == self() && new_successor.between(self(), self()))
+                {
+                    update_successor(routing, new_successor);
+                }
+            });
         }
         return;
     }
+    auto successor = routing->successor();
+    routing.reset();
 
     // std::cout << "[CHECK SUCCESSOR] i.e. " << successor_.addr().to_ip_port() << std::endl;
 
@@ -439,135 +1470,697 @@ void Server::notify_successor()
      * notify the successor, update the successor
      *  and fix the finger table
     */
-    Client client(successor().addr(), std::chrono::seconds(1));
-    auto result = client.send_and_wait_response(Message(
+    Client client(pool_, successor.addr(), probe_timeout_);
+    client.send_and_wait_response(Message(
         Message::PreNotify,
         listen_addr_.to_port()
+    ), [this, successor, start = std::chrono::steady_clock::now()] (bool timeout, const std::optional<Message> &result)
+    {
+        if (!timeout)
+        {
+            record_rtt(successor, start);
+        }
+        /**
+         * a round of stabilization lasts until its answer is applied
+        */
+        ScopedTimer timer(Metrics::instance().stabilize_time, start);
+
+        /**
+         * the successor has been changed by others meanwhile
+        */
+        if (routing_.get()->successor() != successor)
+        {
+            return;
+        }
+
+        if (!timeout)
+        {
+            Node new_successor(result->param_as_addr());
+            std::vector<Node> list;
+            auto fields = result->view().size();
+            for (std::size_t i = 2; i + 1 < fields; i += 2)
+            {
+                list.emplace_back(result->param_as_addr(i));
+            }
+
+            routing_.update([this, &successor, &new_successor, &list] (Routing &routing)
+            {
+                if (routing.successor() != successor)
+                {
+                    return;
+                }
+                if (new_successor.between(self(), successor))
+                {
+                    update_successor(routing, new_successor);
+                    return;
+                }
+                routing.successors.update(successor, list);
+            });
+            return;
+        }
+
+        /**
+         * the next successor takes over at once,
+         *  and is notified right now rather than in the next round
+        */
+        routing_.update([this, &successor] (Routing &routing)
+        {
+            if (routing.successor() == successor)
+            {
+                remove_node(routing, successor);
+            }
+        });
+
+        notify_successor();
+    });
+}
+
+/**
+ * the table is only a guess which is fixed by the later refreshes,
+ *  so nothing is lost if the successor doesn't answer
+ *  or doesn't know Fingers
+*/
+void Server::bootstrap_fingers(const Node &successor)
+{
+    Client client(pool_, successor.addr(), std::chrono::seconds(1));
+    auto result = client.send_and_wait_response(Message(
+        Message::Fingers, listen_addr_.to_port()
     ));
+    if (!result.has_value() || result->type() != Message::Fingers)
+    {
+        return;
+    }
+
+    std::vector<Node> nodes;
+    auto fields = result->view().size();
+    for (std::size_t i = 0; i + 1 < fields; i += 2)
+    {
+        nodes.emplace_back(result->param_as_addr(i));
+    }
+
+    routing_.update([&nodes] (Routing &routing)
+    {
+        for (auto &node : nodes)
+        {
+            routing.table.insert(node);
+        }
+    });
+
+    std::cout << "[BOOTSTRAP FINGERS] " << nodes.size() << " nodes from "
+        << successor.addr().to_ip_port() << std::endl;
+}
 
-    if (result.has_value())
+/**
+ * refresh all the fingers in one round:
+ *  the consecutive fingers which the table expects to have the same node
+ *  share one lookup, and the lookups of the groups are all in flight at once
+ *
+ * so a round takes about log(N) lookups rather than M,
+ *  the fingers below the successor are answered locally
+*/
+void Server::fix_finger_table()
+{
+    auto routing = routing_.get();
+    auto expected = [&routing, this] (std::size_t ind)
     {
-        auto msg = result.value();
-        Node new_successor(msg.param_as_addr());
+        return routing->table.find_closest_suc(self().hash() + (1ull << ind)).hash();
+    };
 
-        if (new_successor.between(self(), successor()))
+    std::size_t first = 1;
+    for (std::size_t ind = 2; ind <= FingerTable::M; ++ind)
+    {
+        if (ind == FingerTable::M || expected(ind) != expected(first))
         {
-            update_successor(new_successor);
+            refresh_fingers(first, ind - 1);
+            first = ind;
         }
     }
-    else
+}
+
+/**
+ * the node found for the start of first is also finger i
+ *  for each later i whose start it's not before,
+ *  the rest of the group is refreshed by another lookup
+ *
+ * those fingers are set in one update, except the one whose interval
+ *  holds the node, which is probed for a closer node, see probe_finger
+*/
+void Server::refresh_fingers(std::size_t first, std::size_t last)
+{
+    auto first_start = self().hash() + (1ull << first);
+    find_successor(first_start, [this, first, last, first_start, start = std::chrono::steady_clock::now()] (const Message &result)
     {
-        table_.remove(successor());
-        update_successor(table_.find_closest_suc(self()));
+        record_lookup(result, start);
+
+        Node node(result.param_as_addr());
+        auto reach = (node.hash() - first_start).value();
+        auto end = first;
+        while (end <= last && (1ull << end) - (1ull << first) <= reach)
+        {
+            ++end;
+        }
+
+        auto stale = false;
+        std::optional<std::size_t> covering;
+        auto routing = routing_.get();
+        for (auto ind = first; ind < end; ++ind)
+        {
+            if (routing->table.covers(ind, node))
+            {
+                covering = ind;
+            }
+            else if (routing->table[ind] != node)
+            {
+                stale = true;
+            }
+        }
+        routing.reset();
+
+        if (stale)
+        {
+            routing_.update([first, end, &node] (Routing &routing)
+            {
+                for (auto ind = first; ind < end; ++ind)
+                {
+                    if (!routing.table.covers(ind, node))
+                    {
+                        routing.table.set(ind, node);
+                    }
+                }
+            });
+        }
+        if (covering.has_value())
+        {
+            probe_finger(covering.value(), node, {});
+        }
+
+        auto ind = end;
+        if (ind <= last)
+        {
+            refresh_fingers(ind, last);
+        }
+    });
+}
+
+/**
+ * walk the nodes in the interval of finger i from the first one,
+ *  each of them is asked for its successor by SucNotify
+ *  which measures the rtt to it on the way,
+ *  then the fastest to reach becomes the finger
+*/
+void Server::probe_finger(std::size_t ind, Node node, std::vector<Node> candidates)
+{
+    if (!routing_.get()->table.covers(ind, node))
+    {
+        if (candidates.empty())
+        {
+            routing_.update([ind, &node] (Routing &routing)
+            {
+                routing.table.set(ind, node);
+            });
+            return;
+        }
+
+        auto best = proximity_.choose(ind, candidates);
+        routing_.update([ind, &best] (Routing &routing)
+        {
+            routing.table.set(ind, best);
+        });
+        return;
     }
+
+    Client client(pool_, node.addr(), probe_timeout_);
+    client.send_and_wait_response(Message(
+        Message::SucNotify,
+        listen_addr_.to_port()
+    ), [this, ind, node, candidates = std::move(candidates), start = std::chrono::steady_clock::now()]
+        (bool timeout, const std::optional<Message> &result) mutable
+    {
+        if (!timeout)
+        {
+            record_rtt(node, start);
+            candidates.push_back(node);
+        }
+
+        if (!timeout && candidates.size() < Proximity::kCandidates)
+        {
+            probe_finger(ind, Node(result->param_as_addr()), std::move(candidates));
+            return;
+        }
+        if (candidates.empty())
+        {
+            return;
+        }
+
+        auto best = proximity_.choose(ind, candidates);
+        routing_.update([ind, &best] (Routing &routing)
+        {
+            routing.table.set(ind, best);
+        });
+    });
+}
+
+void Server::record_lookup(const Message &result, std::chrono::steady_clock::time_point start)
+{
+    auto &metrics = Metrics::instance();
+    metrics.lookup_time.observe(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start
+    ).count());
+    if (result.view().size() >= 5)
+    {
+        metrics.lookup_hops.observe(result.param_as_number(4));
+    }
+}
+
+void Server::record_rtt(const Node &node, std::chrono::steady_clock::time_point start)
+{
+    proximity_.record(node, std::chrono::duration_cast<Proximity::Duration>(
+        std::chrono::steady_clock::now() - start
+    ));
 }
 
 /**
- * FIXME: Unstable now
+ * block until the lookup finishes,
+ *  for the input thread and the tools
 */
-void Server::fix_finger_table()
+Message Server::find_successor(const HashType &hash)
 {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> dis(1, FingerTable::M - 1);
+    std::promise<Message> promise;
+    auto future = promise.get_future();
 
-    auto ind = dis(gen);
-    Node node(find_successor(self().hash() + (1ull << ind)).param_as_addr());
-    table_[ind] = node;
+    auto start = std::chrono::steady_clock::now();
+    find_successor(hash, [&promise] (const Message &result)
+    {
+        promise.set_value(result);
+    });
+
+    auto result = future.get();
+    record_lookup(result, start);
+    return result;
 }
 
 /**
  * FIXME: Unstable now
 */
-Message Server::find_successor(const HashType &hash)
+void Server::find_successor(const HashType &hash, FindSucCallback callback)
 {
+    auto routing = routing_.get();
     /**
      * if self <= hash < successor
      *  return the direct successor
     */
-    if (hash == self().hash() || hash.between(self().hash(), successor().hash()))
+    if (hash == self().hash() || hash.between(self().hash(), routing->successor().hash()))
     {
-        return Message(Message::FindSuc, successor().addr());
+        callback(Message(Message::FindSuc, routing->successor().addr()).add_addr(listen_addr_).add_number(0));
+        return;
     }
-    else
+    routing.reset();
+
+    // Client client(successor().addr(), std::chrono::seconds(1));
+    // auto result = client.send_and_wait_response(Message(
+    //     Message::FindSuc, hash
+    // ));
+    // if (result.has_value())
+    // {
+    //     return result.value();
+    // }
+    // else
+    // {
+    //     return Message(Message::FindSuc, successor().addr());
+    // }
+
+    auto route = cache_.find(hash);
+    if (route.has_value())
+    {
+        find_successor_by_cache(route.value(), hash, std::move(callback));
+        return;
+    }
+
+    if (lookup_mode_ == Iterative)
     {
-        // Client client(successor().addr(), std::chrono::seconds(1));
-        // auto result = client.send_and_wait_response(Message(
-        //     Message::FindSuc, hash
-        // ));
-        // if (result.has_value())
-        // {
-        //     return result.value();
-        // }
-        // else
-        // {
-        //     return Message(Message::FindSuc, successor().addr());
-        // }
-
-        auto ask_node = table_.find_closest_pre(hash);
+        find_successor_iteratively(hash, std::move(callback));
+        return;
+    }
+    find_successor_recursively(hash, std::move(callback));
+}
+
+/**
+ * the node before the cached arc is asked directly,
+ *  the full lookup is done only if it doesn't confirm the owner
+*/
+void Server::find_successor_by_cache(const LookupCache::Route &route, const HashType &hash, FindSucCallback callback)
+{
+    Client client(pool_, route.via.addr(), lookup_timeout_);
+    client.send_and_wait_response(Message(
+        Message::ClosestPre, hash
+    ), [this, hash, route, callback = std::move(callback)] (bool timeout, const std::optional<Message> &result)
+    {
+        if (!timeout && result->param_as_flag(2))
+        {
+            Node owner(result->param_as_addr());
+            if (owner != route.owner)
+            {
+                cache_.remove(route.owner);
+                cache_.insert(route.via, owner);
+            }
+            callback(Message(Message::FindSuc, owner.addr()).add_addr(route.via.addr()).add_number(1));
+            return;
+        }
+
+        cache_.remove(route.via);
+        if (lookup_mode_ == Iterative)
+        {
+            find_successor_iteratively(hash, callback);
+            return;
+        }
+        find_successor_recursively(hash, callback);
+    });
+}
+
+void Server::find_successor_recursively(const HashType &hash, FindSucCallback callback)
+{
+    auto routing = routing_.get();
+    auto ask_node = routing->table.find_closest_pre(hash);
+    /**
+     * if the hash's successor is not the direct successor
+     *  and cannot find another node which is closed to the hash
+     *  then ask the direct successor
+    */
+    if (ask_node == self())
+    {
+        ask_node = routing->successor();
+    }
+    routing.reset();
+
+    Client client(pool_, ask_node.addr(), lookup_timeout_);
+    client.send_and_wait_response(Message(
+        Message::FindSuc, hash
+    ), [this, hash, ask_node, callback = std::move(callback)] (bool timeout, const std::optional<Message> &result)
+    {
+        if (!timeout)
+        {
+            /**
+             * one more hop for the asking node,
+             *  peers which don't count hops are passed through
+            */
+            auto &found = result.value();
+            remember(found);
+            if (found.view().size() < 5)
+            {
+                callback(found);
+                return;
+            }
+            callback(Message(Message::FindSuc, found.param_as_addr())
+                .add_addr(found.param_as_addr(2))
+                .add_number(found.param_as_number(4) + 1));
+            return;
+        }
+
         /**
-         * if the hash's successor is not the direct successor
-         *  and cannot find another node which is closed to the hash
-         *  then ask the direct successor
+         * if the node is dead then remove it and refind
         */
-        if (ask_node == self())
+        routing_.update([this, &ask_node] (Routing &routing)
+        {
+            remove_node(routing, ask_node);
+        });
+        find_successor(hash, callback);
+    });
+}
+
+void Server::find_successor_iteratively(const HashType &hash, FindSucCallback callback)
+{
+    auto routing = routing_.get();
+    /**
+     * the direct successor is the last resort
+     *  if no finger precedes the hash
+    */
+    auto candidates = routing->table.find_closest_pres(hash, lookup_alpha_);
+    if (candidates.empty())
+    {
+        candidates.push_back(routing->successor());
+    }
+    routing.reset();
+
+    Lookup::start(pool_, hash, std::move(candidates), lookup_alpha_, lookup_timeout_,
+        [this, callback = std::move(callback)] (const std::optional<Node> &result,
+            const std::optional<Node> &via, std::size_t probes)
         {
-            ask_node = successor();
+            if (result.has_value())
+            {
+                Message found(Message::FindSuc, result->addr());
+                found.add_addr(via->addr()).add_number(probes);
+                remember(found);
+                callback(found);
+                return;
+            }
+
+            callback(Message(Message::FindSuc, routing_.get()->successor().addr()));
+        },
+        [this] (const Node &node)
+        {
+            routing_.update([this, &node] (Routing &routing)
+            {
+                remove_node(routing, node);
+            });
         }
+    );
+}
 
-        Client client(ask_node.addr(), std::chrono::seconds(1));
-        auto result = client.send_and_wait_response(Message(
-            Message::FindSuc, hash
-        ));
+std::vector<Node> Server::find_successors(const std::vector<HashType> &hashes)
+{
+    std::promise<std::vector<Node>> promise;
+    auto future = promise.get_future();
+
+    find_successors(hashes, [&promise] (std::vector<Node> owners)
+    {
+        promise.set_value(std::move(owners));
+    });
+    return future.get();
+}
+
+/**
+ * a batch is split by the next hop of each key:
+ *  the keys in (self, successor] are answered here,
+ *  the others go to their closest preceding fingers in one FindSucs each,
+ *  which do the same, so a batch costs a walk for each distinct path
+ *  rather than one for each key
+ *
+ * the sub-batches are in flight at once and merged in the order of the keys,
+ *  the keys of a hop which fails or leaves some of them out
+ *  are looked up one by one, since it may be dead or just not know FindSucs
+ *
+ * it's always recursive, whatever the lookup mode
+*/
+void Server::find_successors(std::vector<HashType> hashes, FindSucsCallback callback)
+{
+    struct Batch
+    {
+        std::vector<Node> owners;
+        std::size_t pending;
+        FindSucsCallback callback;
+        std::mutex mutex;
+    };
+
+    auto batch = std::make_shared<Batch>();
+    batch->owners.assign(hashes.size(), self());
+    batch->pending = 1;
+    batch->callback = std::move(callback);
+
+    /**
+     * the extra pending count is held until all the sub-batches are sent,
+     *  so that a quick answer cannot finish the batch early
+    */
+    auto finish = [batch]
+    {
+        std::unique_lock lock(batch->mutex);
+        if (--batch->pending > 0)
+        {
+            return;
+        }
+        lock.unlock();
+        batch->callback(std::move(batch->owners));
+    };
 
-        if (result.has_value())
+    std::map<HashType, std::pair<Node, std::vector<std::size_t>>> hops;
+    {
+        auto routing = routing_.get();
+        auto &successor = routing->successor();
+        for (std::size_t i = 0; i < hashes.size(); ++i)
         {
-            return result.value();
+            auto &hash = hashes[i];
+            if (hash == self().hash() || hash.between(self().hash(), successor.hash()))
+            {
+                batch->owners[i] = successor;
+                continue;
+            }
+
+            auto next = routing->table.find_closest_pre(hash);
+            if (next == self())
+            {
+                next = successor;
+            }
+            auto &hop = hops.try_emplace(next.hash(), next, std::vector<std::size_t>()).first->second;
+            hop.second.push_back(i);
         }
-        else
+    }
+
+    {
+        std::lock_guard lock(batch->mutex);
+        batch->pending += hops.size();
+    }
+
+    for (auto &[key, hop] : hops)
+    {
+        auto &[next, inds] = hop;
+        Message msg(Message::FindSucs);
+        std::vector<HashType> sub;
+        for (auto i : inds)
+        {
+            msg.add_number(hashes[i].value());
+            sub.push_back(hashes[i]);
+        }
+
+        Client client(pool_, next.addr(), lookup_timeout_);
+        client.send_and_wait_response(msg, [this, batch, finish, inds = std::move(inds), sub = std::move(sub)]
+            (bool timeout, const std::optional<Message> &result)
         {
+            auto merge = [batch, finish, inds] (const std::vector<Node> &owners)
+            {
+                {
+                    std::lock_guard lock(batch->mutex);
+                    for (std::size_t k = 0; k < inds.size() && k < owners.size(); ++k)
+                    {
+                        batch->owners[inds[k]] = owners[k];
+                    }
+                }
+                finish();
+            };
+
+            std::vector<Node> answered;
+            if (!timeout && result->type() == Message::FindSucs)
+            {
+                for (auto &addr : result->view().params_as_addrs())
+                {
+                    answered.emplace_back(addr);
+                }
+            }
+            if (answered.size() > sub.size())
+            {
+                answered.clear();
+            }
+            if (answered.size() == sub.size())
+            {
+                merge(answered);
+                return;
+            }
+
             /**
-             * if the node is dead then remove it and refind
+             * the keys missing from a short answer,
+             *  or all of them if it's malformed or the hop failed
             */
-            table_.remove(ask_node);
-            return find_successor(hash);
-        }
+            auto first = answered.size();
+            auto owners = std::make_shared<std::vector<Node>>(std::move(answered));
+            owners->resize(sub.size(), self());
+            auto left = std::make_shared<std::atomic<std::size_t>>(sub.size() - first);
+            for (std::size_t k = first; k < sub.size(); ++k)
+            {
+                find_successor(sub[k], [owners, left, k, merge] (const Message &found)
+                {
+                    (*owners)[k] = Node(found.param_as_addr());
+                    if (--*left == 0)
+                    {
+                        merge(*owners);
+                    }
+                });
+            }
+        });
     }
+
+    finish();
 }
 
-const Node &Server::self() const
+/**
+ * the node which answered the lookup follows the owner in the result,
+ *  peers which don't add it are not cached
+*/
+void Server::remember(const Message &result)
 {
-    return table_.self();
+    if (result.view().size() < 4)
+    {
+        return;
+    }
+
+    Node via(result.param_as_addr(2));
+    if (via != self())
+    {
+        cache_.insert(via, Node(result.param_as_addr()));
+    }
 }
 
-Node &Server::successor()
+const Node &Server::self() const
 {
-    return table_[0];
+    return self_;
 }
 
-void Server::update_predecessor(const Node &new_predecessor)
+void Server::update_predecessor(Routing &routing, Node new_predecessor)
 {
-    if (predecessor_ == new_predecessor)
+    if (routing.predecessor == new_predecessor)
     {
         return;
     }
 
     std::cout << "[UPDATE PREDECESSOR] To " << new_predecessor.addr().to_ip_port() << std::endl;
+    note_churn();
 
-    predecessor_ = new_predecessor;
-    table_.insert(new_predecessor);
+    /**
+     * a node has joined between the old predecessor and self,
+     *  the keys in (old predecessor, new predecessor] belong to it now
+    */
+    if (new_predecessor.between(routing.predecessor, self()) && !is_local(new_predecessor.addr()))
+    {
+        std::thread migrate_thread([this, from = routing.predecessor.hash(), to = new_predecessor.hash(),
+            dst_addr = new_predecessor.addr()]
+        {
+            migrate(from, to, dst_addr);
+        });
+        migrate_thread.detach();
+    }
+
+    routing.predecessor = new_predecessor;
+    routing.table.insert(new_predecessor);
 }
 
-void Server::update_successor(const Node &new_successor)
+void Server::update_successor(Routing &routing, Node new_successor)
 {
-    if (successor() == new_successor)
+    if (routing.successor() == new_successor)
     {
         return;
     }
 
     std::cout << "[UPDATE SUCCESSOR] To " << new_successor.addr().to_ip_port() << std::endl;
+    note_churn();
+
+    routing.table.set(0, new_successor);
+    routing.table.insert(new_successor);
 
-    successor() = new_successor;
-    table_.insert(new_successor);
+    /**
+     * the old ones follow the new one,
+     *  until the list is copied from it in stabilization
+    */
+    auto rest = routing.successors.nodes();
+    routing.successors.update(new_successor, rest);
+}
+
+void Server::remove_node(Routing &routing, Node node)
+{
+    cache_.remove(node);
+    proximity_.remove(node);
+    routing.table.remove(node);
+    note_churn();
+    if (routing.successors.remove(node) || routing.successor() == self())
+    {
+        update_successor(routing, routing.successors.empty()
+            ? routing.table.find_closest_suc(self()) : routing.successors.front());
+    }
 }
 } // namespace chord
@@ -2,10 +2,25 @@
 #define __CHORD_SERVER_HPP__
 
 #include "node.hpp"
+#include "store.hpp"
+#include "routing.hpp"
 #include "message.hpp"
-#include "fingertable.hpp"
+#include "snapshot.hpp"
+#include "proximity.hpp"
+#include "lookupcache.hpp"
+#include "ratelimiter.hpp"
+#include "adaptivetimer.hpp"
+#include "connectionpool.hpp"
 
+#include <set>
+#include <array>
+#include <cmath>
 #include <mutex>
+#include <memory>
+#include <optional>
+#include <chrono>
+#include <atomic>
+#include <functional>
 #include <icarus/eventloop.hpp>
 #include <icarus/tcpserver.hpp>
 #include <icarus/inetaddress.hpp>
@@ -13,17 +28,122 @@
 
 namespace chord
 {
+class FileSender;
 class Instruction;
+struct ObjectInfo;
 class Server
 {
   public:
-    Server(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr);
+    enum LookupMode
+    {
+        Recursive, // each hop forwards the FindSuc and waits for the answer
+        Iterative, // the originator asks each hop by ClosestPre
+    };
+
+    /**
+     * whether a node shares the store with this one,
+     *  i.e. it's another virtual node of the same host
+    */
+    using LocalCheck = std::function<bool(const icarus::InetAddress &addr)>;
+
+    /**
+     * the periodic work of a node, each one runs on a timer of its own
+     *  in the loop, see AdaptiveTimer
+    */
+    enum Routine
+    {
+        Stabilize, // notify the successor and copy its successor list
+        CheckPredecessor,
+        FixFingers,
+        CompactStore,
+    };
+    static constexpr std::size_t kRoutines = CompactStore + 1;
+
+    /**
+     * in seconds, a routine runs every min while the ring is changing
+     *  and backs off up to max while it's stable
+    */
+    struct Period
+    {
+        double min;
+        double max;
+
+        /**
+         * a min of 0 would keep the timer firing at once
+        */
+        bool valid() const
+        {
+            return min > 0 && min <= max && std::isfinite(max);
+        }
+    };
+    static Period default_period(Routine routine);
+
+    static constexpr std::chrono::milliseconds kLookupTimeout{1000};
+    static constexpr std::chrono::milliseconds kProbeTimeout{250};
+    /**
+     * the transfers in flight at once of mget and mput by default
+    */
+    static constexpr std::size_t kBulkConcurrency = 8;
+
+  public:
+    /**
+     * the pool and the store may be shared by several servers, see Host
+    */
+    Server(icarus::EventLoop *loop, const icarus::InetAddress &listen_addr,
+        ConnectionPool &pool, Store &store);
 
     void start();
     void stop();
+    /**
+     * stop answering at once without telling the ring,
+     *  as if the node crashed, only for testing
+    */
+    void halt();
+    /**
+     * these block, so they must not be called in the loop
+    */
+    bool join(const icarus::InetAddress &dst_addr);
+    void self_boot();
+    bool established() const;
+    std::shared_ptr<const Routing> routing() const;
+    const icarus::InetAddress &listen_addr() const;
+
+    /**
+     * must be called before start
+    */
+    void set_thread_num(int num);
+    void set_local_check(LocalCheck is_local);
+
+    void set_lookup_mode(LookupMode mode);
+    /**
+     * the number of concurrent probes of an iterative lookup
+    */
+    void set_lookup_alpha(std::size_t alpha);
+    /**
+     * the timeout of each hop of a lookup
+    */
+    void set_lookup_timeout(std::chrono::milliseconds time);
+    /**
+     * the timeout of the requests of the routines,
+     *  a neighbour which doesn't answer in time is taken as dead
+    */
+    void set_probe_timeout(std::chrono::milliseconds time);
+    void set_successor_list_size(std::size_t size);
+    void set_period(Routine routine, Period period);
 
     void handle_instruction(const Instruction &ins);
 
+    /**
+     * block until the lookup finishes,
+     *  so it must not be called in the loop
+    */
+    Message find_successor(const HashType &hash);
+    /**
+     * the owners of many keys at once, in the same order,
+     *  see find_successors below
+    */
+    std::vector<Node> find_successors(const std::vector<HashType> &hashes);
+
   private:
     void handle_instruction_join(const std::string &value);
     void handle_instruction_get (const std::string &value);
@@ -31,39 +151,181 @@ class Server
     void handle_instruction_quit();
     void handle_instruction_selfboot();
     void handle_instruction_print();
+    void handle_instruction_stats();
+    void handle_instruction_mget(const std::string &value);
+    void handle_instruction_mput(const std::string &value);
 
     void on_message(const icarus::TcpConnectionPtr &conn, icarus::Buffer *buf);
-    void on_message_join      (const icarus::TcpConnectionPtr &conn, const Message &msg);
-    void on_message_findsuc   (const icarus::TcpConnectionPtr &conn, const Message &msg);
-    void on_message_prenotify (const icarus::TcpConnectionPtr &conn, const Message &msg);
-    void on_message_sucnotify (const icarus::TcpConnectionPtr &conn, const Message &msg);
-    void on_message_prequit   (const icarus::TcpConnectionPtr &conn, const Message &msg);
-    void on_message_sucquit   (const icarus::TcpConnectionPtr &conn, const Message &msg);
-    void on_message_get       (const icarus::TcpConnectionPtr &conn, const Message &msg);
-    void on_message_put       (const icarus::TcpConnectionPtr &conn, const Message &msg);
-
-    void stabilize();
+    /**
+     * return false if no more messages should be read from the connection,
+     *  which is then closed by the handler
+    */
+    bool dispatch(const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_join      (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_findsuc   (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_prenotify (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_sucnotify (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_prequit   (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_sucquit   (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_get       (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_put       (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_fetch     (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_fetchkey  (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_migrate   (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_closestpre(const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_hello     (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_fingers   (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+    void on_message_findsucs  (const icarus::TcpConnectionPtr &conn, const MessageView &msg);
+
+    /**
+     * length bytes from offset of the object, or less at its end,
+     *  only from the store if the version is given
+    */
+    std::shared_ptr<FileSender> open_object(const std::string &filename,
+        std::uint64_t offset = 0, std::uint64_t length = UINT64_MAX,
+        std::optional<std::uint64_t> version = std::nullopt);
+    bool is_putting(const std::string &filename);
+    /**
+     * copy between a local file and the store of this node
+    */
+    std::optional<std::size_t> import_object(const HashType &key, const std::string &filename);
+    std::optional<std::size_t> export_object(const HashType &key, const std::string &filename);
+
+    /**
+     * copy a file from or to its owner, which may be a local node,
+     *  they block until it's done and return its size
+    */
+    std::optional<std::size_t> get_file(const HashType &key, const std::string &filename,
+        const icarus::InetAddress &owner);
+    std::optional<std::size_t> put_file(const HashType &key, const std::string &filename,
+        const icarus::InetAddress &owner);
+    /**
+     * get or put all the files with at most concurrency of them at once,
+     *  see handle_instruction_mget
+    */
+    void transfer_files(bool put, const std::vector<std::string> &filenames, std::size_t concurrency);
+    /**
+     * the owner and those of the nodes after it which hold the same object,
+     *  see StripedFetch
+    */
+    std::vector<icarus::InetAddress> find_holders(const icarus::InetAddress &owner,
+        const std::string &filename, const ObjectInfo &object);
+
+    /**
+     * move the objects in (from, to] to the given node,
+     *  it blocks until they are all acknowledged
+    */
+    std::size_t migrate(const HashType &from, const HashType &to, const icarus::InetAddress &dst_addr);
+
+    bool is_local(const icarus::InetAddress &addr) const;
+    /**
+     * start or stop the timers of the routines
+    */
+    void start_stabilize();
+    void stop_stabilize();
+    void compact_store();
+    /**
+     * the ring around this node has changed,
+     *  so the routines are run at their min periods again
+    */
+    void note_churn();
     void notify_predecessor();
     void notify_successor();
+    /**
+     * copy the fingers of the successor right after joining,
+     *  they are close to the right ones since it's next to self
+    */
+    void bootstrap_fingers(const Node &successor);
     void fix_finger_table();
+    /**
+     * refresh the fingers in [first, last] by a lookup of the start of first,
+     *  see fix_finger_table
+    */
+    void refresh_fingers(std::size_t first, std::size_t last);
+    /**
+     * for the lookups started by this node
+    */
+    void record_lookup(const Message &result, std::chrono::steady_clock::time_point start);
+    void probe_finger(std::size_t ind, Node node, std::vector<Node> candidates);
+    void record_rtt(const Node &node, std::chrono::steady_clock::time_point start);
 
-    Message find_successor(const HashType &hash);
+    /**
+     * the callback may be called in the current thread
+     *  or later in the loop of the pool
+    */
+    using FindSucCallback = std::function<void(const Message &result)>;
+    void find_successor(const HashType &hash, FindSucCallback callback);
+    void find_successor_by_cache(const LookupCache::Route &route, const HashType &hash, FindSucCallback callback);
+    void find_successor_recursively(const HashType &hash, FindSucCallback callback);
+    void find_successor_iteratively(const HashType &hash, FindSucCallback callback);
+    /**
+     * fill the lookup cache from a FindSuc result
+    */
+    void remember(const Message &result);
+
+    /**
+     * the owners are in the order of the hashes,
+     *  the callback is called once in any thread
+    */
+    using FindSucsCallback = std::function<void(std::vector<Node> owners)>;
+    void find_successors(std::vector<HashType> hashes, FindSucsCallback callback);
 
     const Node &self() const;
-    Node &successor();
-    void update_predecessor(const Node &new_predecessor);
-    void update_successor(const Node &new_successor);
+    /**
+     * these change the copy of the routing state being updated,
+     *  see Snapshot::update
+     *
+     * cannot use const reference to Node
+     *  because it may be the node in the finger table
+    */
+    void update_predecessor(Routing &routing, Node new_predecessor);
+    void update_successor(Routing &routing, Node new_successor);
+    /**
+     * forget a dead node, and fail over to the next successor
+     *  at once if it was the successor
+    */
+    void remove_node(Routing &routing, Node node);
 
   private:
-    Node predecessor_;
-    FingerTable table_;
+    Node self_;
+    /**
+     * lookups read it without locking,
+     *  stabilization and quit handling install new versions
+    */
+    Snapshot<Routing> routing_;
+    LookupCache cache_;
+    Proximity proximity_;
 
-    bool established_;
+    std::atomic<bool> established_;
+    LookupMode lookup_mode_;
+    std::size_t lookup_alpha_;
+    std::chrono::milliseconds lookup_timeout_;
+    std::chrono::milliseconds probe_timeout_;
     icarus::EventLoop *loop_;
     icarus::InetAddress listen_addr_;
     icarus::TcpServer tcp_server_;
+    ConnectionPool &pool_;
+    Store &store_;
+    LocalCheck is_local_;
+    /**
+     * shared by the migrations from this node
+     *  and the FetchKey transfers they lead to
+    */
+    RateLimiter migration_rate_;
+    /**
+     * the local files with a Put in flight,
+     *  which their owners fetch from this node, see open_object
+    */
+    std::mutex putting_mutex_;
+    std::multiset<std::string> putting_;
 
-    std::mutex mutex_;
+    /**
+     * the timers are only touched in the loop
+    */
+    std::array<std::unique_ptr<AdaptiveTimer>, kRoutines> timers_;
+    std::atomic<std::uint64_t> churn_;
+    std::array<std::uint64_t, kRoutines> seen_churn_;
+    std::atomic<bool> compacting_;
 };
 } // namespace chord
 
@@ -0,0 +1,140 @@
+#ifndef __CHORD_SNAPSHOT_HPP__
+#define __CHORD_SNAPSHOT_HPP__
+
+#include "metrics.hpp"
+
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+namespace chord
+{
+/**
+ * a value published as immutable versions, in the manner of RCU
+ *
+ * readers get the current version without taking any lock,
+ *  each thread keeps the version it got last and only reloads it
+ *  when a writer has installed a new one since,
+ *  and forgets it once the snapshot is destroyed
+ *
+ * writers copy the current version, change the copy and install it,
+ *  they are serialized by a lock which readers never touch
+ *  and a version lives as long as any reader still holds it
+*/
+template <typename T>
+class Snapshot
+{
+  public:
+    /**
+     * the wait for the writer lock is observed in the histogram if any
+    */
+    explicit Snapshot(T value, Histogram *lock_wait = nullptr)
+      : id_(next_id())
+      , alive_(std::make_shared<char>())
+      , version_(1)
+      , value_(std::make_shared<const T>(std::move(value)))
+      , lock_wait_(lock_wait)
+    {
+        // ...
+    }
+
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    std::shared_ptr<const T> get() const
+    {
+        thread_local std::vector<Cached> cache;
+
+        /**
+         * the versions held for the snapshots destroyed since
+         *  are released here, as they cannot reach this thread
+        */
+        cache.erase(std::remove_if(cache.begin(), cache.end(), [] (const Cached &cached)
+        {
+            return cached.alive.expired();
+        }), cache.end());
+
+        auto version = version_.load(std::memory_order_acquire);
+        for (auto &cached : cache)
+        {
+            if (cached.id != id_)
+            {
+                continue;
+            }
+            if (cached.version != version)
+            {
+                cached.value = std::atomic_load(&value_);
+                cached.version = version;
+            }
+            return cached.value;
+        }
+
+        cache.push_back(Cached { id_, alive_, version, std::atomic_load(&value_) });
+        return cache.back().value;
+    }
+
+    /**
+     * func is called with the copy to change,
+     *  it must not call update of the same snapshot
+    */
+    template <typename Func>
+    void update(Func &&func)
+    {
+        std::unique_lock lock(mutex_, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            std::optional<ScopedTimer> timer;
+            if (lock_wait_ != nullptr)
+            {
+                timer.emplace(*lock_wait_);
+            }
+            lock.lock();
+        }
+        auto next = std::make_shared<T>(*value_);
+        func(*next);
+
+        std::atomic_store(&value_, std::shared_ptr<const T>(std::move(next)));
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+  private:
+    struct Cached
+    {
+        std::uint64_t id;
+        std::weak_ptr<const void> alive;
+        std::uint64_t version;
+        std::shared_ptr<const T> value;
+    };
+
+    /**
+     * the caches of the threads are keyed by it rather than the address,
+     *  which may be reused by another snapshot
+    */
+    static std::uint64_t next_id()
+    {
+        static std::atomic<std::uint64_t> id(0);
+        return ++id;
+    }
+
+  private:
+    std::uint64_t id_;
+    /**
+     * expires with the snapshot, for the caches of the threads
+    */
+    std::shared_ptr<const void> alive_;
+    std::atomic<std::uint64_t> version_;
+    /**
+     * only accessed by std::atomic_load and std::atomic_store
+     *  except by the writer holding the lock
+    */
+    std::shared_ptr<const T> value_;
+    std::mutex mutex_;
+    Histogram *lock_wait_;
+};
+} // namespace chord
+
+#endif
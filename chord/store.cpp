@@ -0,0 +1,782 @@
+#include "store.hpp"
+
+#include <array>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+#include <sys/uio.h>
+#include <sys/stat.h>
+
+namespace chord
+{
+namespace
+{
+constexpr std::uint32_t kRecordMagic = 0x43484f52;
+constexpr std::size_t kHeaderSize = 36;
+constexpr std::uint32_t kTombstone = 1;
+
+/**
+ * magic flags key version size checksum
+ *  in the byte order of this machine, the files never leave it
+*/
+struct Header
+{
+    std::uint32_t magic;
+    std::uint32_t flags;
+    std::uint64_t key;
+    std::uint64_t version;
+    std::uint64_t size;
+    std::uint32_t checksum;
+};
+
+void encode_header(char *out, const Header &header)
+{
+    std::memcpy(out, &header.magic, 4);
+    std::memcpy(out + 4, &header.flags, 4);
+    std::memcpy(out + 8, &header.key, 8);
+    std::memcpy(out + 16, &header.version, 8);
+    std::memcpy(out + 24, &header.size, 8);
+    std::memcpy(out + 32, &header.checksum, 4);
+}
+
+Header decode_header(const char *in)
+{
+    Header header;
+    std::memcpy(&header.magic, in, 4);
+    std::memcpy(&header.flags, in + 4, 4);
+    std::memcpy(&header.key, in + 8, 8);
+    std::memcpy(&header.version, in + 16, 8);
+    std::memcpy(&header.size, in + 24, 8);
+    std::memcpy(&header.checksum, in + 32, 4);
+    return header;
+}
+
+bool write_all(int fd, const char *data, std::size_t len)
+{
+    while (len > 0)
+    {
+        auto n = ::write(fd, data, len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool pread_all(int fd, char *data, std::size_t len, std::uint64_t offset)
+{
+    while (len > 0)
+    {
+        auto n = ::pread(fd, data, len, offset);
+        if (n <= 0)
+        {
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+std::optional<Header> read_header(int fd, std::uint64_t offset)
+{
+    char buf[kHeaderSize];
+    if (!pread_all(fd, buf, kHeaderSize, offset))
+    {
+        return {};
+    }
+
+    auto header = decode_header(buf);
+    if (header.magic != kRecordMagic)
+    {
+        return {};
+    }
+    return header;
+}
+} // namespace
+
+std::uint32_t Store::crc32(std::uint32_t crc, const char *data, std::size_t len)
+{
+    static const auto table = []
+    {
+        std::array<std::uint32_t, 256> table{};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            auto c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < len; ++i)
+    {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+std::optional<std::uint32_t> Store::crc32(int fd, std::uint64_t size)
+{
+    std::vector<char> buf(1 << 16);
+    std::uint32_t crc = 0;
+    for (std::uint64_t offset = 0; offset < size; )
+    {
+        auto len = static_cast<std::size_t>(std::min<std::uint64_t>(buf.size(), size - offset));
+        auto n = ::pread(fd, buf.data(), len, static_cast<off_t>(offset));
+        if (n <= 0)
+        {
+            return {};
+        }
+        crc = crc32(crc, buf.data(), static_cast<std::size_t>(n));
+        offset += static_cast<std::uint64_t>(n);
+    }
+    return crc;
+}
+
+Store::Writer::Writer(Store &store, const HashType &key, std::uint64_t version)
+  : store_(store)
+  , key_(key)
+  , version_(version)
+  , size_(0)
+  , checksum_(0)
+  , fd_(-1)
+  , segment_(0)
+  , done_(false)
+{
+    // ...
+}
+
+Store::Writer::~Writer()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        ::unlink(store_.path_of(segment_).c_str());
+    }
+}
+
+bool Store::Writer::append(const char *data, std::size_t len)
+{
+    if (done_)
+    {
+        return false;
+    }
+
+    checksum_ = crc32(checksum_, data, len);
+    size_ += len;
+    if (fd_ < 0 && buffer_.size() + len <= kInlineSize)
+    {
+        buffer_.append(data, len);
+        return true;
+    }
+
+    if (fd_ < 0 && !spill())
+    {
+        return false;
+    }
+    return write_all(fd_, data, len);
+}
+
+/**
+ * the header is left blank until commit,
+ *  so a segment of an unfinished object is dropped on recovery
+*/
+bool Store::Writer::spill()
+{
+    {
+        std::lock_guard lock(store_.mutex_);
+        segment_ = store_.new_segment();
+    }
+
+    fd_ = ::open(store_.path_of(segment_).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        return false;
+    }
+
+    char blank[kHeaderSize] = {};
+    if (!write_all(fd_, blank, kHeaderSize) || !write_all(fd_, buffer_.data(), buffer_.size()))
+    {
+        return false;
+    }
+    std::string().swap(buffer_);
+    return true;
+}
+
+bool Store::Writer::commit()
+{
+    if (done_)
+    {
+        return false;
+    }
+    done_ = true;
+
+    std::lock_guard lock(store_.mutex_);
+    auto version = store_.next_version(key_, version_);
+    if (version == 0)
+    {
+        return true;
+    }
+
+    if (fd_ < 0)
+    {
+        return store_.append_record(key_, version, 0, buffer_.data(), buffer_.size(), checksum_);
+    }
+
+    char buf[kHeaderSize];
+    encode_header(buf, Header{kRecordMagic, 0, key_.value(), version, size_, checksum_});
+    auto ok = ::pwrite(fd_, buf, kHeaderSize, 0) == static_cast<ssize_t>(kHeaderSize);
+    ::close(fd_);
+    fd_ = -1;
+    if (!ok)
+    {
+        ::unlink(store_.path_of(segment_).c_str());
+        return false;
+    }
+
+    store_.segments_[segment_] = Segment{kHeaderSize + size_, 0};
+    store_.apply(key_, 0, Entry{segment_, kHeaderSize, size_, version, checksum_});
+    return true;
+}
+
+std::uint64_t Store::Writer::size() const
+{
+    return size_;
+}
+
+Store::Store(const std::string &dir)
+  : dir_(dir)
+  , active_fd_(-1)
+  , active_(0)
+  , next_segment_(0)
+{
+    ::mkdir(dir_.c_str(), 0755);
+    recover();
+    open_active();
+}
+
+Store::~Store()
+{
+    if (active_fd_ >= 0)
+    {
+        ::close(active_fd_);
+    }
+}
+
+bool Store::put(const HashType &key, const char *data, std::size_t len, std::uint64_t version)
+{
+    auto checksum = crc32(0, data, len);
+
+    std::lock_guard lock(mutex_);
+    version = next_version(key, version);
+    if (version == 0)
+    {
+        return true;
+    }
+    return append_record(key, version, 0, data, len, checksum);
+}
+
+std::unique_ptr<Store::Writer> Store::writer(const HashType &key, std::uint64_t version)
+{
+    return std::make_unique<Writer>(*this, key, version);
+}
+
+/**
+ * a tombstone is appended
+ *  so that the object doesn't come back on recovery
+*/
+bool Store::remove(const HashType &key, std::uint64_t version)
+{
+    std::lock_guard lock(mutex_);
+    auto it = index_.find(key.value());
+    if (it == index_.end() || (version != 0 && it->second.version != version))
+    {
+        return false;
+    }
+    return append_record(key, it->second.version + 1, kTombstone, nullptr, 0, 0);
+}
+
+std::optional<Store::Entry> Store::find(const HashType &key) const
+{
+    std::lock_guard lock(mutex_);
+    auto it = index_.find(key.value());
+    if (it == index_.end())
+    {
+        return {};
+    }
+    return it->second;
+}
+
+std::optional<Store::Location> Store::locate(const HashType &key)
+{
+    std::lock_guard lock(mutex_);
+    auto it = index_.find(key.value());
+    if (it == index_.end())
+    {
+        return {};
+    }
+
+    auto segment = it->second.segment;
+    ++readers_[segment];
+    std::shared_ptr<void> hold(nullptr, [this, segment] (void *)
+    {
+        release(segment);
+    });
+    return Location{path_of(segment), it->second.offset, it->second.size,
+        it->second.version, it->second.checksum, std::move(hold)};
+}
+
+std::vector<std::pair<std::size_t, Store::Entry>> Store::range(const HashType &from, const HashType &to) const
+{
+    std::lock_guard lock(mutex_);
+    if (from == to)
+    {
+        return {index_.begin(), index_.end()};
+    }
+
+    auto first = index_.upper_bound(from.value());
+    auto last = index_.upper_bound(to.value());
+    if (from < to)
+    {
+        return {first, last};
+    }
+
+    /**
+     * wrap around zero
+    */
+    std::vector<std::pair<std::size_t, Entry>> result(first, index_.end());
+    result.insert(result.end(), index_.begin(), last);
+    return result;
+}
+
+std::optional<std::string> Store::get(const HashType &key) const
+{
+    int fd = -1;
+    Entry entry;
+    {
+        /**
+         * open it under the lock
+         *  so that the segment cannot be compacted away before
+        */
+        std::lock_guard lock(mutex_);
+        auto it = index_.find(key.value());
+        if (it == index_.end())
+        {
+            return {};
+        }
+        entry = it->second;
+        fd = ::open(path_of(entry.segment).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0)
+    {
+        return {};
+    }
+
+    std::string data(entry.size, '\0');
+    auto ok = pread_all(fd, data.data(), data.size(), entry.offset);
+    ::close(fd);
+    if (!ok)
+    {
+        return {};
+    }
+    return data;
+}
+
+std::size_t Store::size() const
+{
+    std::lock_guard lock(mutex_);
+    return index_.size();
+}
+
+bool Store::compact()
+{
+    std::lock_guard compacting(compact_mutex_);
+
+    std::uint32_t id = 0;
+    std::uint64_t size = 0;
+    {
+        std::lock_guard lock(mutex_);
+        auto victim = segments_.end();
+        for (auto it = segments_.begin(); it != segments_.end(); ++it)
+        {
+            auto &[id, segment] = *it;
+            if (id != active_ && segment.dead * 2 >= segment.size
+                && (victim == segments_.end() || segment.dead > victim->second.dead))
+            {
+                victim = it;
+            }
+        }
+        if (victim == segments_.end())
+        {
+            return false;
+        }
+        id = victim->first;
+        size = victim->second.size;
+    }
+
+    int fd = ::open(path_of(id).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    std::string data;
+    for (std::uint64_t offset = 0; offset + kHeaderSize <= size; )
+    {
+        auto header = read_header(fd, offset);
+        if (!header.has_value())
+        {
+            break;
+        }
+        auto record = offset;
+        offset += kHeaderSize + header->size;
+
+        {
+            std::lock_guard lock(mutex_);
+            if (!is_live(id, record, header->key, header->version, header->flags))
+            {
+                continue;
+            }
+        }
+
+        data.resize(header->size);
+        if (!pread_all(fd, data.data(), data.size(), record + kHeaderSize))
+        {
+            ::close(fd);
+            return false;
+        }
+
+        /**
+         * check it again as it may be replaced while being read
+        */
+        std::lock_guard lock(mutex_);
+        if (is_live(id, record, header->key, header->version, header->flags)
+            && !append_record(HashType(header->key), header->version, header->flags,
+                data.data(), data.size(), header->checksum))
+        {
+            ::close(fd);
+            return false;
+        }
+    }
+    ::close(fd);
+
+    std::lock_guard lock(mutex_);
+    segments_.erase(id);
+    retire(id);
+    std::cout << "[STORE] Compact segment " << id << std::endl;
+    return true;
+}
+
+std::string Store::path_of(std::uint32_t segment) const
+{
+    char name[16];
+    std::snprintf(name, sizeof(name), "%08u.log", segment);
+    return dir_ + "/" + name;
+}
+
+void Store::recover()
+{
+    std::vector<std::uint32_t> ids;
+    if (auto dir = ::opendir(dir_.c_str()))
+    {
+        while (auto ent = ::readdir(dir))
+        {
+            unsigned id = 0;
+            char tail = 0;
+            if (std::strlen(ent->d_name) == 12
+                && std::sscanf(ent->d_name, "%8u.lo%c", &id, &tail) == 2 && tail == 'g')
+            {
+                ids.push_back(id);
+            }
+        }
+        ::closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    /**
+     * replay the segments in order, later records win,
+     *  then count what's not referenced by the index as garbage
+    */
+    std::map<std::uint32_t, std::uint64_t> sizes;
+    for (auto id : ids)
+    {
+        auto size = recover_segment(id);
+        if (size == 0)
+        {
+            ::unlink(path_of(id).c_str());
+            continue;
+        }
+        sizes[id] = size;
+    }
+
+    for (auto &[id, size] : sizes)
+    {
+        segments_[id] = Segment{size, size};
+    }
+    for (auto &[key, entry] : index_)
+    {
+        segments_[entry.segment].dead -= kHeaderSize + entry.size;
+    }
+
+    next_segment_ = ids.empty() ? 0 : ids.back() + 1;
+    std::cout << "[STORE] Recover " << index_.size() << " objects"
+        << " from " << segments_.size() << " segments" << std::endl;
+}
+
+/**
+ * return the size of the valid prefix of the segment,
+ *  and cut off the torn record at the end if any
+*/
+std::uint64_t Store::recover_segment(std::uint32_t segment)
+{
+    int fd = ::open(path_of(segment).c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    struct stat st;
+    ::fstat(fd, &st);
+    auto file_size = static_cast<std::uint64_t>(st.st_size);
+
+    std::uint64_t offset = 0;
+    while (offset + kHeaderSize <= file_size)
+    {
+        auto header = read_header(fd, offset);
+        auto next = header.has_value() ? offset + kHeaderSize + header->size : 0;
+        if (!header.has_value() || next > file_size)
+        {
+            break;
+        }
+
+        /**
+         * only the last record may be torn,
+         *  don't read the whole log to check the others
+        */
+        if (next + kHeaderSize > file_size)
+        {
+            std::uint32_t checksum = 0;
+            std::vector<char> buf(64 * 1024);
+            for (auto pos = offset + kHeaderSize; pos < next; )
+            {
+                auto len = std::min<std::uint64_t>(buf.size(), next - pos);
+                if (!pread_all(fd, buf.data(), len, pos))
+                {
+                    break;
+                }
+                checksum = crc32(checksum, buf.data(), len);
+                pos += len;
+            }
+            if (checksum != header->checksum)
+            {
+                break;
+            }
+        }
+
+        apply(HashType(header->key), header->flags,
+            Entry{segment, offset + kHeaderSize, header->size, header->version, header->checksum});
+        offset = next;
+    }
+
+    if (offset < file_size)
+    {
+        std::cout << "[STORE] Truncate segment " << segment
+            << " from " << file_size << " to " << offset << " bytes" << std::endl;
+        ::ftruncate(fd, offset);
+    }
+    ::close(fd);
+
+    return offset;
+}
+
+void Store::open_active()
+{
+    if (active_fd_ >= 0)
+    {
+        ::close(active_fd_);
+    }
+
+    active_ = new_segment();
+    active_fd_ = ::open(path_of(active_).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    segments_[active_] = Segment{0, 0};
+}
+
+std::uint32_t Store::new_segment()
+{
+    return next_segment_++;
+}
+
+/**
+ * 0 if the given version is not newer than the stored one
+ *
+ * a removed key is put again after its tombstone,
+ *  otherwise the tombstone would hide it on recovery
+*/
+std::uint64_t Store::next_version(const HashType &key, std::uint64_t version) const
+{
+    auto it = index_.find(key.value());
+    auto removed = tombstones_.find(key.value());
+    auto latest = it != index_.end() ? it->second.version
+        : removed != tombstones_.end() ? removed->second : 0;
+
+    if (version == 0)
+    {
+        return latest + 1;
+    }
+    if (it != index_.end() && it->second.version >= version)
+    {
+        return 0;
+    }
+    return std::max(version, latest + 1);
+}
+
+bool Store::append_record(const HashType &key, std::uint64_t version, std::uint32_t flags,
+    const char *data, std::size_t len, std::uint32_t checksum)
+{
+    if (segments_[active_].size + kHeaderSize + len > kSegmentSize && segments_[active_].size > 0)
+    {
+        open_active();
+    }
+    if (active_fd_ < 0)
+    {
+        return false;
+    }
+
+    char buf[kHeaderSize];
+    encode_header(buf, Header{kRecordMagic, flags, key.value(), version, len, checksum});
+
+    iovec iov[2] = {
+        {buf, kHeaderSize},
+        {const_cast<char *>(data), len},
+    };
+    auto offset = segments_[active_].size;
+    if (::writev(active_fd_, iov, 2) != static_cast<ssize_t>(kHeaderSize + len))
+    {
+        ::ftruncate(active_fd_, offset);
+        return false;
+    }
+
+    segments_[active_].size += kHeaderSize + len;
+    apply(key, flags, Entry{active_, offset + kHeaderSize, len, version, checksum});
+    return true;
+}
+
+/**
+ * point the index to the new record
+ *  and count the one it replaces as garbage
+ *
+ * the records of a key may be replayed out of order on recovery,
+ *  so a tombstone is remembered to drop the older ones after it
+*/
+void Store::apply(const HashType &key, std::uint32_t flags, const Entry &entry)
+{
+    auto mark_dead = [this] (std::uint32_t segment, std::uint64_t size)
+    {
+        auto it = segments_.find(segment);
+        if (it != segments_.end())
+        {
+            it->second.dead += kHeaderSize + size;
+        }
+    };
+
+    auto it = index_.find(key.value());
+    if (it != index_.end() && it->second.version > entry.version)
+    {
+        mark_dead(entry.segment, entry.size);
+        return;
+    }
+
+    if (flags & kTombstone)
+    {
+        mark_dead(entry.segment, entry.size);
+        if (it != index_.end())
+        {
+            mark_dead(it->second.segment, it->second.size);
+            index_.erase(it);
+        }
+        auto &version = tombstones_[key.value()];
+        version = std::max(version, entry.version);
+        return;
+    }
+
+    auto removed = tombstones_.find(key.value());
+    if (removed != tombstones_.end())
+    {
+        if (removed->second >= entry.version)
+        {
+            mark_dead(entry.segment, entry.size);
+            return;
+        }
+        tombstones_.erase(removed);
+    }
+    if (it != index_.end())
+    {
+        mark_dead(it->second.segment, it->second.size);
+    }
+    index_[key.value()] = entry;
+}
+
+/**
+ * a tombstone is still needed if another sealed segment
+ *  may hold what it deleted, the ids don't tell it
+ *  as a large object gets its segment before it's committed
+*/
+bool Store::is_live(std::uint32_t segment, std::uint64_t offset,
+    std::size_t key, std::uint64_t version, std::uint32_t flags) const
+{
+    auto it = index_.find(key);
+    if (!(flags & kTombstone))
+    {
+        return it != index_.end() && it->second.segment == segment && it->second.offset == offset + kHeaderSize;
+    }
+
+    auto removed = tombstones_.find(key);
+    if (it != index_.end() || removed == tombstones_.end() || removed->second != version)
+    {
+        return false;
+    }
+    return !retired_.empty() || std::any_of(segments_.begin(), segments_.end(), [this, segment] (const auto &other)
+    {
+        return other.first != segment && other.first != active_;
+    });
+}
+
+void Store::retire(std::uint32_t segment)
+{
+    if (readers_.count(segment) > 0)
+    {
+        retired_.insert(segment);
+        return;
+    }
+    ::unlink(path_of(segment).c_str());
+}
+
+void Store::release(std::uint32_t segment)
+{
+    std::lock_guard lock(mutex_);
+    auto it = readers_.find(segment);
+    if (it == readers_.end() || --it->second > 0)
+    {
+        return;
+    }
+    readers_.erase(it);
+    if (retired_.erase(segment) > 0)
+    {
+        ::unlink(path_of(segment).c_str());
+    }
+}
+} // namespace chord
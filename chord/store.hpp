@@ -0,0 +1,206 @@
+#ifndef __CHORD_STORE_HPP__
+#define __CHORD_STORE_HPP__
+
+#include "hashtype.hpp"
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+namespace chord
+{
+/**
+ * the objects kept by this node, in append-only log segments
+ *  under a directory of its own
+ *
+ * a record is a fixed header followed by the data,
+ *  the in-memory index keeps where the latest version of each key is
+ *  and is rebuilt by scanning the segments when the store is opened
+ *
+ * small objects are appended to the active segment,
+ *  large ones are spilled to a segment of their own while being received
+ *  so that a slow transfer never holds the log
+ *
+ * all the methods are thread-safe
+*/
+class Store
+{
+  public:
+    static constexpr std::size_t kSegmentSize = 64 << 20;
+    /**
+     * objects above it are written to their own segments
+    */
+    static constexpr std::size_t kInlineSize = 1 << 20;
+
+    struct Entry
+    {
+        std::uint32_t segment;
+        std::uint64_t offset; // of the data, after the header
+        std::uint64_t size;
+        std::uint64_t version;
+        std::uint32_t checksum; // crc32 of the data
+    };
+
+    /**
+     * where the data of an object can be read from directly,
+     *  the segment is not removed by compact while it's held,
+     *  so open the path before dropping it
+    */
+    struct Location
+    {
+        std::string path;
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::uint64_t version;
+        std::uint32_t checksum;
+        std::shared_ptr<void> hold;
+    };
+
+    /**
+     * receive an object piece by piece,
+     *  it becomes visible only after commit
+     *  and is discarded if it's destroyed before that
+    */
+    class Writer
+    {
+      public:
+        Writer(Store &store, const HashType &key, std::uint64_t version);
+        ~Writer();
+
+        Writer(const Writer &) = delete;
+        Writer &operator=(const Writer &) = delete;
+
+        bool append(const char *data, std::size_t len);
+        bool commit();
+        std::uint64_t size() const;
+
+      private:
+        bool spill();
+
+        Store &store_;
+        HashType key_;
+        std::uint64_t version_;
+        std::uint64_t size_;
+        std::uint32_t checksum_;
+        std::string buffer_;
+        /**
+         * the segment it's spilled to, or -1
+        */
+        int fd_;
+        std::uint32_t segment_;
+        bool done_;
+    };
+
+  public:
+    /**
+     * the checksum kept of each object, continued from crc,
+     *  and the one of the first size bytes of a file,
+     *  so that a copy of an object can be checked against it
+    */
+    static std::uint32_t crc32(std::uint32_t crc, const char *data, std::size_t len);
+    static std::optional<std::uint32_t> crc32(int fd, std::uint64_t size);
+
+    explicit Store(const std::string &dir);
+    ~Store();
+
+    Store(const Store &) = delete;
+    Store &operator=(const Store &) = delete;
+
+    /**
+     * version 0 means the one after the current version,
+     *  otherwise the object is ignored if it's older than the stored one
+    */
+    bool put(const HashType &key, const char *data, std::size_t len, std::uint64_t version = 0);
+    std::unique_ptr<Writer> writer(const HashType &key, std::uint64_t version = 0);
+    /**
+     * version 0 means any version,
+     *  otherwise only that version is removed
+    */
+    bool remove(const HashType &key, std::uint64_t version = 0);
+
+    std::optional<Entry> find(const HashType &key) const;
+    std::optional<Location> locate(const HashType &key);
+    /**
+     * the objects whose keys are in (from, to] on the ring,
+     *  or all of them if from equals to
+    */
+    std::vector<std::pair<std::size_t, Entry>> range(const HashType &from, const HashType &to) const;
+    /**
+     * read the whole object into memory, only for small ones
+    */
+    std::optional<std::string> get(const HashType &key) const;
+    std::size_t size() const;
+
+    /**
+     * rewrite the live records of the sealed segment
+     *  which has the most garbage, if at least half of it is garbage
+     *
+     * the segment is read without the lock,
+     *  which is only taken to check and copy each live record
+     *
+     * return false if there is nothing to compact
+    */
+    bool compact();
+
+  private:
+    struct Segment
+    {
+        std::uint64_t size;
+        std::uint64_t dead;
+    };
+
+    std::string path_of(std::uint32_t segment) const;
+    void recover();
+    std::uint64_t recover_segment(std::uint32_t segment);
+    void open_active();
+    std::uint32_t new_segment();
+
+    /**
+     * these need the lock
+    */
+    std::uint64_t next_version(const HashType &key, std::uint64_t version) const;
+    bool append_record(const HashType &key, std::uint64_t version, std::uint32_t flags,
+        const char *data, std::size_t len, std::uint32_t checksum);
+    void apply(const HashType &key, std::uint32_t flags, const Entry &entry);
+    bool is_live(std::uint32_t segment, std::uint64_t offset,
+        std::size_t key, std::uint64_t version, std::uint32_t flags) const;
+    /**
+     * unlink the segment unless a Location holds it,
+     *  then it's unlinked when the last one is dropped
+    */
+    void retire(std::uint32_t segment);
+    void release(std::uint32_t segment);
+
+  private:
+    std::string dir_;
+
+    std::map<std::size_t, Entry> index_;
+    /**
+     * the removed keys and the versions of their tombstones,
+     *  an older record of them may still be in some segment
+     *  and be replayed after the tombstone on recovery
+    */
+    std::map<std::size_t, std::uint64_t> tombstones_;
+    std::map<std::uint32_t, Segment> segments_;
+    /**
+     * the number of locations held for each segment,
+     *  and the compacted segments waiting for them
+    */
+    std::map<std::uint32_t, std::size_t> readers_;
+    std::set<std::uint32_t> retired_;
+
+    int active_fd_;
+    std::uint32_t active_;
+    std::uint32_t next_segment_;
+
+    mutable std::mutex mutex_;
+    std::mutex compact_mutex_;
+};
+} // namespace chord
+
+#endif
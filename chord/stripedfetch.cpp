@@ -0,0 +1,291 @@
+#include "store.hpp"
+#include "client.hpp"
+#include "message.hpp"
+#include "stripedfetch.hpp"
+
+#include <fcntl.h>
+#include <thread>
+#include <cstdio>
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+
+namespace chord
+{
+namespace
+{
+/**
+ * how often a source without work looks for a slow stripe
+*/
+constexpr auto kPollInterval = std::chrono::milliseconds(100);
+} // namespace
+
+StripedFetch::StripedFetch(ConnectionPool &pool, std::string filename, const ObjectInfo &object,
+    std::vector<icarus::InetAddress> sources, std::uint64_t from)
+  : pool_(pool)
+  , filename_(std::move(filename))
+  , size_(object.size)
+  , version_(object.version)
+  , checksum_(object.checksum)
+  , sources_(std::move(sources))
+  , fd_(-1)
+  , done_(0)
+  , mean_time_(0)
+  , fetched_(sources_.size(), 0)
+  , failed_(sources_.size(), false)
+{
+    for (auto offset = from; offset < size_; offset += kStripeSize)
+    {
+        stripes_.push_back({offset, std::min(kStripeSize, size_ - offset), false, 0, 0, {}, {}});
+    }
+
+    /**
+     * taken from the back, so the stripes go roughly in order
+    */
+    for (auto ind = stripes_.size(); ind > 0; --ind)
+    {
+        pending_.push_back(ind - 1);
+    }
+}
+
+std::optional<std::uint64_t> StripedFetch::run(const std::string &path)
+{
+    auto part = path + ".part";
+    fd_ = ::open(part.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        return {};
+    }
+    if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+    {
+        ::close(fd_);
+        return {};
+    }
+
+    std::vector<std::thread> workers;
+    for (std::size_t source = 0; source < sources_.size(); ++source)
+    {
+        for (std::size_t k = 0; k < kPerSource; ++k)
+        {
+            workers.emplace_back([this, source]
+            {
+                work(source);
+            });
+        }
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    /**
+     * only the stripes done in a row from the start are kept,
+     *  so that the part can be resumed from its end, see Client::fetch_file
+    */
+    if (done_ < stripes_.size())
+    {
+        auto verified = stripes_.front().offset;
+        for (auto &stripe : stripes_)
+        {
+            if (!stripe.done)
+            {
+                break;
+            }
+            verified = stripe.offset + stripe.length;
+        }
+        if (::ftruncate(fd_, static_cast<off_t>(verified)) != 0)
+        {
+            std::cout << "[STRIPED GET] Cannot keep the part of " << filename_ << std::endl;
+        }
+    }
+
+    /**
+     * which stripe is wrong is unknown, so none of them is kept
+    */
+    auto intact = done_ < stripes_.size() || version_ == 0 || Store::crc32(fd_, size_) == checksum_;
+    if (!intact)
+    {
+        std::cout << "[STRIPED GET] " << filename_ << " doesn't match its checksum" << std::endl;
+        if (::ftruncate(fd_, 0) != 0)
+        {
+            std::cout << "[STRIPED GET] Cannot drop the part of " << filename_ << std::endl;
+        }
+    }
+    ::close(fd_);
+
+    std::cout << "[STRIPED GET] " << filename_ << " in " << stripes_.size() << " stripes";
+    for (std::size_t source = 0; source < sources_.size(); ++source)
+    {
+        std::cout << "\n[STRIPED GET] " << fetched_[source] << " bytes from " << sources_[source].to_ip_port()
+            << (failed_[source] ? " which failed" : "");
+    }
+    std::cout << std::endl;
+
+    if (done_ < stripes_.size() || !intact || std::rename(part.c_str(), path.c_str()) != 0)
+    {
+        return {};
+    }
+    return size_;
+}
+
+void StripedFetch::work(std::size_t source)
+{
+    while (auto ind = next(source))
+    {
+        if (!fetch(source, ind.value()))
+        {
+            return;
+        }
+    }
+}
+
+std::optional<std::size_t> StripedFetch::next(std::size_t source)
+{
+    std::unique_lock lock(mutex_);
+    while (!over() && !failed_[source])
+    {
+        if (!pending_.empty())
+        {
+            auto ind = pending_.back();
+            pending_.pop_back();
+
+            auto &stripe = stripes_[ind];
+            ++stripe.fetchers;
+            stripe.source = source;
+            stripe.start = std::chrono::steady_clock::now();
+            return ind;
+        }
+
+        /**
+         * the usual time is only known after some stripe is done
+        */
+        auto now = std::chrono::steady_clock::now();
+        for (std::size_t ind = 0; ind < stripes_.size() && done_ > 0; ++ind)
+        {
+            auto &stripe = stripes_[ind];
+            if (!stripe.done && stripe.fetchers == 1 && stripe.source != source
+                && now - stripe.start > kSlowFactor * mean_time_)
+            {
+                ++stripe.fetchers;
+                return ind;
+            }
+        }
+
+        /**
+         * a failed stripe may be pending again,
+         *  or a running one may turn slow meanwhile
+        */
+        cond_.wait_for(lock, kPollInterval);
+    }
+    return {};
+}
+
+bool StripedFetch::fetch(std::size_t source, std::size_t ind)
+{
+    auto &stripe = stripes_[ind];
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t received = 0;
+    bool dropped = false;
+
+    Client client(pool_, sources_[source]);
+    {
+        /**
+         * it may be done since it was handed out
+        */
+        std::lock_guard lock(mutex_);
+        if (stripe.done)
+        {
+            --stripe.fetchers;
+            cond_.notify_all();
+            return true;
+        }
+        stripe.clients.push_back(&client);
+    }
+
+    /**
+     * a source with another version of the object sends nothing
+    */
+    Message msg(Message::Fetch, filename_);
+    msg.add_number(stripe.offset).add_number(stripe.length);
+    if (version_ != 0)
+    {
+        msg.add_number(version_);
+    }
+
+    ObjectInfo object;
+    auto size = client.fetch(msg,
+        [this, &stripe, &received, &dropped] (const char *data, std::size_t len)
+        {
+            {
+                std::lock_guard lock(mutex_);
+                if (stripe.done)
+                {
+                    dropped = true;
+                    return false;
+                }
+            }
+
+            /**
+             * a peer which ignores the range sends too much
+            */
+            if (received + len > stripe.length
+                || ::pwrite(fd_, data, len, static_cast<off_t>(stripe.offset + received)) != static_cast<ssize_t>(len))
+            {
+                return false;
+            }
+            received += len;
+            return true;
+        },
+        &object
+    );
+    if (version_ != 0 && (object.version != version_ || object.checksum != checksum_))
+    {
+        size.reset();
+    }
+
+    std::lock_guard lock(mutex_);
+    --stripe.fetchers;
+    stripe.clients.erase(std::find(stripe.clients.begin(), stripe.clients.end(), &client));
+    cond_.notify_all();
+
+    if (size.has_value() && size.value() == stripe.length)
+    {
+        if (!stripe.done)
+        {
+            stripe.done = true;
+            ++done_;
+            mean_time_ = (mean_time_ * (done_ - 1) + (std::chrono::steady_clock::now() - start)) / done_;
+            fetched_[source] += stripe.length;
+
+            /**
+             * the slower one may wait for data which never comes
+            */
+            for (auto other : stripe.clients)
+            {
+                other->cancel();
+            }
+        }
+        return true;
+    }
+
+    /**
+     * the other fetch of the stripe has won
+    */
+    if (dropped || stripe.done)
+    {
+        return true;
+    }
+
+    if (stripe.fetchers == 0)
+    {
+        pending_.push_back(ind);
+    }
+    failed_[source] = true;
+    return false;
+}
+
+bool StripedFetch::over() const
+{
+    return done_ == stripes_.size();
+}
+} // namespace chord
@@ -0,0 +1,118 @@
+#ifndef __CHORD_STRIPEDFETCH_HPP__
+#define __CHORD_STRIPEDFETCH_HPP__
+
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+#include <condition_variable>
+#include <icarus/inetaddress.hpp>
+
+namespace chord
+{
+class Client;
+class ConnectionPool;
+struct ObjectInfo;
+/**
+ * download an object from several nodes which hold it at once
+ *
+ * the object is cut into stripes which are fetched as ranges,
+ *  each source has kPerSource of them in flight and takes the next one
+ *  as soon as it's done with one, so a faster source takes more of them
+ *
+ * when no stripe is left to start, a stripe which has run kSlowFactor times
+ *  longer than usual is fetched again from another source,
+ *  and the slower fetch is cancelled as soon as either is done,
+ *  even if its source has stalled
+ *
+ * a source must send the version of the object in its store,
+ *  with the checksum of the whole as the owner told
+ *
+ * the stripes are written in place to path.part,
+ *  which is renamed to path only after all of them arrive
+ *  and the checksum of the whole is found to match,
+ *  otherwise it's cut after the last stripe done in a row from the start
+ *  to be resumed later, it blocks, so it must not run in the loop of the pool
+*/
+class StripedFetch
+{
+  public:
+    static constexpr std::uint64_t kStripeSize = 4 << 20;
+    /**
+     * the smaller objects are fetched whole from one source
+    */
+    static constexpr std::uint64_t kMinSize = 2 * kStripeSize;
+    static constexpr std::size_t kMaxSources = 4;
+    static constexpr std::size_t kPerSource = 2;
+    static constexpr double kSlowFactor = 2;
+
+  public:
+    /**
+     * the bytes before from are already in path.part,
+     *  nothing is checked if the object has no version
+    */
+    StripedFetch(ConnectionPool &pool, std::string filename, const ObjectInfo &object,
+        std::vector<icarus::InetAddress> sources, std::uint64_t from = 0);
+
+    /**
+     * return the size of the object,
+     *  or nothing if some stripe cannot be fetched from any source
+    */
+    std::optional<std::uint64_t> run(const std::string &path);
+
+  private:
+    struct Stripe
+    {
+        std::uint64_t offset;
+        std::uint64_t length;
+        bool done;
+        std::size_t fetchers;
+        /**
+         * the first source fetching it
+        */
+        std::size_t source;
+        std::chrono::steady_clock::time_point start;
+        /**
+         * of the fetches in flight, to cancel the others once one is done
+        */
+        std::vector<Client *> clients;
+    };
+
+    void work(std::size_t source);
+    /**
+     * the next stripe for the source, a pending one
+     *  or a slow one to fetch again, nothing if it's all over
+    */
+    std::optional<std::size_t> next(std::size_t source);
+    /**
+     * return false if the source failed
+    */
+    bool fetch(std::size_t source, std::size_t ind);
+    bool over() const;
+
+  private:
+    ConnectionPool &pool_;
+    std::string filename_;
+    std::uint64_t size_;
+    std::uint64_t version_;
+    std::uint32_t checksum_;
+    std::vector<icarus::InetAddress> sources_;
+    int fd_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<Stripe> stripes_;
+    std::vector<std::size_t> pending_;
+    std::size_t done_;
+    /**
+     * the mean time of the stripes done so far
+    */
+    std::chrono::steady_clock::duration mean_time_;
+    std::vector<std::uint64_t> fetched_;
+    std::vector<bool> failed_;
+};
+} // namespace chord
+
+#endif
@@ -0,0 +1,79 @@
+#include "successorlist.hpp"
+
+#include <algorithm>
+
+namespace chord
+{
+SuccessorList::SuccessorList(const Node &self, std::size_t size)
+  : self_(self)
+  , size_(std::max<std::size_t>(size, 1))
+{
+    // ...
+}
+
+const Node &SuccessorList::front() const
+{
+    return nodes_.empty() ? self_ : nodes_.front();
+}
+
+const std::vector<Node> &SuccessorList::nodes() const
+{
+    return nodes_;
+}
+
+bool SuccessorList::empty() const
+{
+    return nodes_.empty();
+}
+
+void SuccessorList::set_size(std::size_t size)
+{
+    size_ = std::max<std::size_t>(size, 1);
+    if (nodes_.size() > size_)
+    {
+        nodes_.erase(nodes_.begin() + size_, nodes_.end());
+    }
+}
+
+std::size_t SuccessorList::max_size() const
+{
+    return size_;
+}
+
+/**
+ * the list wraps around to self on a ring of less than r + 1 nodes,
+ *  stop there
+*/
+void SuccessorList::update(const Node &successor, const std::vector<Node> &list)
+{
+    nodes_.clear();
+    if (successor == self_)
+    {
+        return;
+    }
+
+    nodes_.push_back(successor);
+    for (auto &node : list)
+    {
+        if (nodes_.size() == size_ || node == self_)
+        {
+            break;
+        }
+        if (std::find(nodes_.begin(), nodes_.end(), node) == nodes_.end())
+        {
+            nodes_.push_back(node);
+        }
+    }
+}
+
+bool SuccessorList::remove(const Node &node)
+{
+    auto it = std::find(nodes_.begin(), nodes_.end(), node);
+    if (it == nodes_.end())
+    {
+        return false;
+    }
+    nodes_.erase(it);
+    return true;
+}
+} // namespace chord
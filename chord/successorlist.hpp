@@ -0,0 +1,52 @@
+#ifndef __CHORD_SUCCESSORLIST_HPP__
+#define __CHORD_SUCCESSORLIST_HPP__
+
+#include "node.hpp"
+
+#include <vector>
+#include <cstddef>
+
+namespace chord
+{
+/**
+ * the first r nodes after self on the ring, the closest first,
+ *  so that the next live one takes over at once when the successor dies
+ *
+ * it's rebuilt from the list of the successor in stabilization,
+ *  and never holds self, so it's shorter on a small ring
+*/
+class SuccessorList
+{
+  public:
+    static constexpr std::size_t kDefaultSize = 4;
+
+  public:
+    SuccessorList(const Node &self, std::size_t size = kDefaultSize);
+
+    /**
+     * self if the list is empty
+    */
+    const Node &front() const;
+    const std::vector<Node> &nodes() const;
+    bool empty() const;
+
+    void set_size(std::size_t size);
+    std::size_t max_size() const;
+
+    /**
+     * the successor followed by the list it holds
+    */
+    void update(const Node &successor, const std::vector<Node> &list);
+    /**
+     * return true if the node is removed
+    */
+    bool remove(const Node &node);
+
+  private:
+    Node self_;
+    std::size_t size_;
+    std::vector<Node> nodes_;
+};
+} // namespace chord
+
+#endif
@@ -0,0 +1,493 @@
+#include "store.hpp"
+#include "server.hpp"
+#include "metrics.hpp"
+#include "hashtype.hpp"
+#include "connectionpool.hpp"
+
+#include <map>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+#include <algorithm>
+#include <icarus/eventloop.hpp>
+#include <icarus/inetaddress.hpp>
+
+using namespace chord;
+
+/**
+ * chord_cluster num_of_nodes [script] [base_port]
+ *
+ * run a ring of Servers on loopback in one process,
+ *  node i listens at 127.0.0.1:(base_port + i)
+ *  and has a connection pool and a store of its own
+ *
+ * the script is read from stdin if not given, one command per line:
+ *
+ *  boot i            self-boot node i
+ *  join i j          node i joins the ring by node j
+ *  join-all          every node not in the ring joins by node 0
+ *  kill i            node i stops answering without telling the ring
+ *  quit i            node i leaves the ring gracefully
+ *  wait-stable [s]   wait at most s seconds (60 by default) until
+ *                    the successors and predecessors are all right,
+ *                    and report the time since the last change
+ *  lookups n         look up n random keys from random live nodes,
+ *                    and report the hops, the latency and the errors
+ *  batch-lookups n   look up n random keys in one batch from a random live node,
+ *                    and report the time, the errors and the FindSucs sent
+ *  stats             report the messages handled since the last stats
+ *  period r min max  set the period of routine r of all the nodes,
+ *                    r is stabilize, predecessor, fingers or compact
+ *  timeout t ms      set the timeout of all the nodes in milliseconds,
+ *                    t is lookup or probe
+ *  sleep s           sleep s seconds
+ *  # ...             comment
+ *
+ * the logs of the nodes are silenced, the reports go to stdout
+*/
+namespace
+{
+constexpr std::uint16_t kBasePort = 46000;
+constexpr auto kPollInterval = std::chrono::milliseconds(100);
+
+struct Member
+{
+    Member(icarus::EventLoop *loop, const icarus::InetAddress &addr, const std::string &dir)
+      : pool(loop)
+      , store(dir)
+      , server(loop, addr, pool, store)
+      , alive(false)
+    {
+        // ...
+    }
+
+    ConnectionPool pool;
+    Store store;
+    Server server;
+    bool alive;
+};
+
+class Cluster
+{
+  public:
+    Cluster(icarus::EventLoop *loop, std::size_t num, std::uint16_t base_port, std::ostream &out)
+      : out_(out)
+      , last_change_(std::chrono::steady_clock::now())
+      , gen_(42)
+    {
+        auto dir = "/tmp/chord_cluster-" + std::to_string(::getpid());
+        for (std::size_t i = 0; i < num; ++i)
+        {
+            icarus::InetAddress addr("127.0.0.1", static_cast<std::uint16_t>(base_port + i));
+            members_.push_back(std::make_unique<Member>(loop, addr, dir + "-" + std::to_string(i)));
+            members_.back()->server.set_thread_num(1);
+        }
+    }
+
+    void start()
+    {
+        for (auto &member : members_)
+        {
+            member->server.start();
+        }
+    }
+
+    void run(std::istream &script)
+    {
+        std::string line;
+        while (std::getline(script, line))
+        {
+            std::istringstream in(line);
+            std::string command;
+            if (!(in >> command) || command[0] == '#')
+            {
+                continue;
+            }
+            out_ << "[CLUSTER] > " << line << std::endl;
+
+            if (!run(command, in))
+            {
+                out_ << "<ERROR> Bad Command " << line << std::endl;
+            }
+        }
+    }
+
+  private:
+    bool run(const std::string &command, std::istringstream &in)
+    {
+        std::size_t i = 0, j = 0;
+        double seconds = 0;
+
+        if (command == "boot" && in >> i && i < members_.size())
+        {
+            members_[i]->server.self_boot();
+            members_[i]->alive = true;
+            changed();
+        }
+        else if (command == "join" && in >> i >> j && i < members_.size() && j < members_.size())
+        {
+            join(i, j);
+        }
+        else if (command == "join-all")
+        {
+            for (i = 1; i < members_.size(); ++i)
+            {
+                if (!members_[i]->alive)
+                {
+                    join(i, 0);
+                }
+            }
+        }
+        else if (command == "kill" && in >> i && i < members_.size())
+        {
+            members_[i]->server.halt();
+            members_[i]->alive = false;
+            changed();
+        }
+        else if (command == "quit" && in >> i && i < members_.size())
+        {
+            members_[i]->server.stop();
+            members_[i]->alive = false;
+            changed();
+        }
+        else if (command == "wait-stable")
+        {
+            wait_stable(in >> seconds ? seconds : 60);
+        }
+        else if (command == "lookups" && in >> i)
+        {
+            lookups(i);
+        }
+        else if (command == "batch-lookups" && in >> i)
+        {
+            batch_lookups(i);
+        }
+        else if (command == "stats")
+        {
+            stats();
+        }
+        else if (command == "period")
+        {
+            return period(in);
+        }
+        else if (command == "timeout")
+        {
+            return timeout(in);
+        }
+        else if (command == "sleep" && in >> seconds)
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+    bool period(std::istringstream &in)
+    {
+        static const std::map<std::string, Server::Routine> kRoutines =
+        {
+            {"stabilize", Server::Stabilize},
+            {"predecessor", Server::CheckPredecessor},
+            {"fingers", Server::FixFingers},
+            {"compact", Server::CompactStore},
+        };
+
+        std::string name;
+        Server::Period period;
+        if (!(in >> name >> period.min >> period.max) || kRoutines.count(name) == 0 || !period.valid())
+        {
+            return false;
+        }
+
+        for (auto &member : members_)
+        {
+            member->server.set_period(kRoutines.at(name), period);
+        }
+        return true;
+    }
+
+    bool timeout(std::istringstream &in)
+    {
+        std::string name;
+        std::uint64_t ms = 0;
+        if (!(in >> name >> ms) || (name != "lookup" && name != "probe"))
+        {
+            return false;
+        }
+
+        for (auto &member : members_)
+        {
+            if (name == "lookup")
+            {
+                member->server.set_lookup_timeout(std::chrono::milliseconds(ms));
+            }
+            else
+            {
+                member->server.set_probe_timeout(std::chrono::milliseconds(ms));
+            }
+        }
+        return true;
+    }
+
+    void join(std::size_t i, std::size_t j)
+    {
+        if (members_[i]->server.join(members_[j]->server.listen_addr()))
+        {
+            members_[i]->alive = true;
+            changed();
+            return;
+        }
+        out_ << "[CLUSTER] Node " << i << " failed to join by node " << j << std::endl;
+    }
+
+    void changed()
+    {
+        last_change_ = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * the live nodes sorted by hash, i.e. the ring as it should be
+    */
+    std::vector<Member *> ring() const
+    {
+        std::vector<Member *> ring;
+        for (auto &member : members_)
+        {
+            if (member->alive)
+            {
+                ring.push_back(member.get());
+            }
+        }
+        std::sort(ring.begin(), ring.end(), [] (Member *lhs, Member *rhs)
+        {
+            return HashType(lhs->server.listen_addr()) < HashType(rhs->server.listen_addr());
+        });
+        return ring;
+    }
+
+    bool stable() const
+    {
+        auto nodes = ring();
+        for (std::size_t k = 0; k < nodes.size(); ++k)
+        {
+            auto routing = nodes[k]->server.routing();
+            Node successor(nodes[(k + 1) % nodes.size()]->server.listen_addr());
+            Node predecessor(nodes[(k + nodes.size() - 1) % nodes.size()]->server.listen_addr());
+            if (routing->successor() != successor || routing->predecessor != predecessor)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void wait_stable(double timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+        while (!stable())
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                out_ << "[CLUSTER] Not stable in " << timeout << " seconds" << std::endl;
+                return;
+            }
+            std::this_thread::sleep_for(kPollInterval);
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - last_change_;
+        out_ << "[CLUSTER] Stable with " << ring().size() << " nodes, "
+            << std::fixed << std::setprecision(3) << elapsed.count() << " seconds after the last change"
+            << std::defaultfloat << std::endl;
+    }
+
+    /**
+     * the owner of a key is the first live node at or after it
+    */
+    static const Member *owner_of(const std::vector<Member *> &nodes, const HashType &key)
+    {
+        for (auto member : nodes)
+        {
+            if (key <= HashType(member->server.listen_addr()))
+            {
+                return member;
+            }
+        }
+        return nodes.front();
+    }
+
+    void lookups(std::size_t num)
+    {
+        auto nodes = ring();
+        if (nodes.empty())
+        {
+            out_ << "[CLUSTER] No live node" << std::endl;
+            return;
+        }
+
+        std::vector<double> latencies;
+        std::map<std::uint64_t, std::size_t> hops;
+        std::size_t wrong = 0;
+        for (std::size_t k = 0; k < num; ++k)
+        {
+            auto from = nodes[gen_() % nodes.size()];
+            HashType key(gen_());
+
+            auto start = std::chrono::steady_clock::now();
+            auto result = from->server.find_successor(key);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+            latencies.push_back(elapsed.count());
+            if (result.view().size() >= 5)
+            {
+                ++hops[result.param_as_number(4)];
+            }
+            if (Node(result.param_as_addr()) != Node(owner_of(nodes, key)->server.listen_addr()))
+            {
+                ++wrong;
+            }
+        }
+
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies] (double q)
+        {
+            return latencies[std::min(latencies.size() - 1, static_cast<std::size_t>(q * latencies.size()))];
+        };
+
+        out_ << "[CLUSTER] " << num << " lookups, " << wrong << " wrong owners"
+            << std::fixed << std::setprecision(3)
+            << "\n[CLUSTER] Latency ms p50 " << percentile(0.5)
+            << " p90 " << percentile(0.9)
+            << " p99 " << percentile(0.99)
+            << " max " << latencies.back()
+            << std::defaultfloat;
+        for (auto &[hop, count] : hops)
+        {
+            out_ << "\n[CLUSTER] Hops " << hop << ": " << count;
+        }
+        out_ << std::endl;
+    }
+
+    void batch_lookups(std::size_t num)
+    {
+        auto nodes = ring();
+        if (nodes.empty())
+        {
+            out_ << "[CLUSTER] No live node" << std::endl;
+            return;
+        }
+
+        std::vector<HashType> keys;
+        for (std::size_t k = 0; k < num; ++k)
+        {
+            keys.emplace_back(gen_());
+        }
+
+        auto &handled = Metrics::instance().handled[Message::FindSucs];
+        auto sent = handled.value();
+        auto from = nodes[gen_() % nodes.size()];
+
+        auto start = std::chrono::steady_clock::now();
+        auto owners = from->server.find_successors(keys);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::size_t wrong = 0;
+        for (std::size_t k = 0; k < num; ++k)
+        {
+            if (owners[k] != Node(owner_of(nodes, keys[k])->server.listen_addr()))
+            {
+                ++wrong;
+            }
+        }
+
+        out_ << "[CLUSTER] " << num << " keys in a batch, " << wrong << " wrong owners, "
+            << handled.value() - sent << " FindSucs, "
+            << std::fixed << std::setprecision(3) << elapsed.count() << " ms"
+            << std::defaultfloat << std::endl;
+    }
+
+    /**
+     * the metrics are shared by all the nodes in the process,
+     *  so they count the messages of the whole ring
+    */
+    void stats()
+    {
+        auto &metrics = Metrics::instance();
+        out_ << "[CLUSTER] Messages handled since the last stats";
+        for (std::size_t k = 0; k < Metrics::kTypes; ++k)
+        {
+            auto count = metrics.handled[k].value();
+            if (count != last_handled_[k])
+            {
+                out_ << "\n[CLUSTER] " << Metrics::type_name(k) << ": " << count - last_handled_[k];
+            }
+            last_handled_[k] = count;
+        }
+        out_ << "\n[CLUSTER] Timeouts " << metrics.request_timeouts.value()
+            << ", failures " << metrics.request_failures.value() << std::endl;
+    }
+
+  private:
+    std::ostream &out_;
+    std::vector<std::unique_ptr<Member>> members_;
+    std::chrono::steady_clock::time_point last_change_;
+    std::mt19937_64 gen_;
+    std::array<std::uint64_t, Metrics::kTypes> last_handled_ {};
+};
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 4)
+    {
+        std::cerr << "usage: chord_cluster num_of_nodes [script] [base_port]" << std::endl;
+        return 1;
+    }
+
+    std::ostream out(std::cout.rdbuf());
+    std::cout.rdbuf(nullptr);
+
+    std::ifstream file;
+    if (argc >= 3)
+    {
+        file.open(argv[2]);
+        if (!file)
+        {
+            std::cerr << "<ERROR> Cannot Open " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    auto base_port = argc == 4 ? static_cast<std::uint16_t>(std::stoi(argv[3])) : kBasePort;
+
+    icarus::EventLoop loop;
+    Cluster cluster(&loop, std::stoul(argv[1]), base_port, out);
+    cluster.start();
+
+    std::thread script_thread([&]
+    {
+        cluster.run(argc >= 3 ? file : std::cin);
+        loop.quit();
+    });
+
+    loop.loop();
+    script_thread.join();
+
+    /**
+     * the compaction and transfer threads are detached and may still refer to the nodes,
+     *  so the process ends without destroying them
+    */
+    out.flush();
+    std::quick_exit(0);
+}